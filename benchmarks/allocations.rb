@@ -0,0 +1,115 @@
+$LOAD_PATH.unshift File.expand_path('../lib', __dir__)
+
+require 'json'
+require 'optparse'
+require 'stringio'
+require 'zstd-ruby'
+require_relative 'suite/corpus'
+require_relative 'suite/measure'
+
+# Allocation profile of every API path: Ruby objects and GC runs per call, bytes malloc'd by libzstd
+# (Zstd.malloc_stats counting allocator) and peak RSS. Each path runs in a forked child when fork is
+# available, so peak RSS is per path.
+# Usage:
+#   ruby allocations.rb
+#   ruby allocations.rb --size 1048576 --iterations 100 --json
+
+options = { size: 64 * 1024, iterations: 1000, chunk_size: 16 * 1024, json: false }
+OptionParser.new do |opts|
+  opts.on('--size BYTES', Integer) { |v| options[:size] = v }
+  opts.on('--iterations N', Integer) { |v| options[:iterations] = v }
+  opts.on('--chunk-size BYTES', Integer, 'streaming chunk size') { |v| options[:chunk_size] = v }
+  opts.on('--json', 'print results as JSON') { options[:json] = true }
+end.parse!
+
+data = Zstd::Bench::Corpus.generate('logs', options[:size])
+compressed = Zstd.compress(data)
+chunk_size = options[:chunk_size]
+chunks = (0...data.bytesize).step(chunk_size).map { |pos| data.byteslice(pos, chunk_size) }
+compressed_chunks = (0...compressed.bytesize).step(chunk_size).map { |pos| compressed.byteslice(pos, chunk_size) }
+skippable = Zstd.write_skippable_frame(compressed, 'metadata' * 16)
+dictionary = Zstd::Bench::Corpus.dictionary('logs')
+cdict = Zstd::CDict.new(dictionary)
+ddict = Zstd::DDict.new(dictionary)
+dict_compressed = Zstd.compress(data, dict: cdict)
+
+paths = {
+  'Zstd.compress' => -> { Zstd.compress(data) },
+  'Zstd.compress(dict:)' => -> { Zstd.compress(data, dict: cdict) },
+  'Zstd.decompress' => -> { Zstd.decompress(compressed) },
+  'Zstd.decompress(dict:)' => -> { Zstd.decompress(dict_compressed, dict: ddict) },
+  'StreamingCompress' => lambda {
+    stream = Zstd::StreamingCompress.new
+    chunks.each { |chunk| stream.write(chunk) }
+    stream.finish
+  },
+  'StreamingDecompress' => lambda {
+    stream = Zstd::StreamingDecompress.new
+    compressed_chunks.each { |chunk| stream.decompress(chunk) }
+  },
+  'StreamWriter' => lambda {
+    writer = Zstd::StreamWriter.new(StringIO.new)
+    chunks.each { |chunk| writer.write(chunk) }
+    writer.finish
+  },
+  'StreamReader' => lambda {
+    reader = Zstd::StreamReader.new(StringIO.new(compressed))
+    compressed_chunks.size.times { reader.read(chunk_size) }
+  },
+  'Zstd.write_skippable_frame' => -> { Zstd.write_skippable_frame(compressed, 'metadata' * 16) },
+  'Zstd.read_skippable_frame' => -> { Zstd.read_skippable_frame(skippable) },
+}
+
+profile = lambda do |call|
+  call.call # warm up, e.g. method caches
+  GC.start
+  Zstd.malloc_stats_enabled = true
+  Zstd.reset_malloc_stats
+  gc = GC.stat
+  options[:iterations].times { call.call }
+  after = GC.stat
+  malloc = Zstd.malloc_stats
+  Zstd.malloc_stats_enabled = false
+  n = options[:iterations].to_f
+  {
+    objects_per_call: ((after[:total_allocated_objects] - gc[:total_allocated_objects]) / n).round(2),
+    minor_gc: after[:minor_gc_count] - gc[:minor_gc_count],
+    major_gc: after[:major_gc_count] - gc[:major_gc_count],
+    zstd_mallocs_per_call: (malloc[:allocations] / n).round(2),
+    zstd_malloc_bytes_per_call: (malloc[:allocated_bytes] / n).round,
+    zstd_peak_bytes: malloc[:peak_bytes],
+    peak_rss_kb: Zstd::Bench::Measure.rss[1],
+  }
+end
+
+results = paths.map do |name, call|
+  result =
+    if Process.respond_to?(:fork)
+      reader, writer = IO.pipe
+      pid = fork do
+        reader.close
+        writer.write(JSON.generate(profile.call(call)))
+        writer.close
+        exit!(0)
+      end
+      writer.close
+      json = reader.read
+      reader.close
+      Process.wait(pid)
+      JSON.parse(json, symbolize_names: true)
+    else
+      profile.call(call)
+    end
+  { name: name }.merge(result)
+end
+
+if options[:json]
+  puts JSON.pretty_generate(size: options[:size], iterations: options[:iterations], chunk_size: chunk_size, results: results)
+else
+  puts format('%-28s %12s %8s %8s %14s %18s %14s %12s', 'path', 'objects/call', 'minor GC', 'major GC',
+              'zstd mallocs', 'zstd bytes/call', 'zstd peak', 'peak RSS KB')
+  results.each do |r|
+    puts format('%-28s %12.2f %8d %8d %14.2f %18d %14d %12d', r[:name], r[:objects_per_call], r[:minor_gc], r[:major_gc],
+                r[:zstd_mallocs_per_call], r[:zstd_malloc_bytes_per_call], r[:zstd_peak_bytes], r[:peak_rss_kb])
+  end
+end
@@ -0,0 +1,98 @@
+require 'etc'
+require 'json'
+require 'optparse'
+require 'rbconfig'
+require 'tmpdir'
+require 'fileutils'
+
+# Builds the extension once per trimmed variant of the bundled libzstd and reports the size of the
+# shared object, the time of `require 'zstd-ruby'` in a fresh process and the RSS it adds.
+# Usage:
+#   ruby build_variants.rb
+#   ruby build_variants.rb --runs 50 --json
+#   ruby build_variants.rb --variant default --variant small="--enable-minify --disable-dict-builder"
+
+VARIANTS = {
+  'default' => '',
+  'no-dict-builder' => '--disable-dict-builder',
+  'huf-x1' => '--with-huf-decoder=x1',
+  'huf-x2' => '--with-huf-decoder=x2',
+  'fast-levels-only' => '--exclude-block-compressors=btlazy2,btopt,btultra',
+  'minify' => '--enable-minify',
+  'decompress-only' => '--enable-decompress-only',
+  'decompress-only+minify' => '--enable-decompress-only --enable-minify',
+}
+
+options = { runs: 20, json: false, variants: {} }
+OptionParser.new do |opts|
+  opts.on('--runs N', Integer, 'fresh processes per variant') { |v| options[:runs] = v }
+  opts.on('--variant NAME[=ARGS]', 'extconf arguments of a variant; repeat to select several') do |v|
+    name, args = v.split('=', 2)
+    options[:variants][name] = args || VARIANTS.fetch(name)
+  end
+  opts.on('--json', 'print results as JSON') { options[:json] = true }
+end.parse!
+variants = options[:variants].empty? ? VARIANTS : options[:variants]
+
+extconf = File.expand_path('../ext/zstdruby/extconf.rb', __dir__)
+lib = File.expand_path('../lib', __dir__)
+make = ENV['MAKE'] || 'make'
+dlext = RbConfig::CONFIG['DLEXT']
+
+# the extension is loaded first so the Ruby files of lib/ do not count, then the whole gem
+probe = <<~RUBY
+  def rss
+    File.read('/proc/self/status')[/^VmRSS:\\s+(\\d+)/, 1].to_i
+  rescue SystemCallError
+    0
+  end
+  rss_before = rss
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  require 'zstd-ruby/zstdruby'
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+  require 'zstd-ruby'
+  print elapsed, ' ', rss - rss_before
+RUBY
+
+def median(values)
+  sorted = values.sort
+  (sorted[(sorted.size - 1) / 2] + sorted[sorted.size / 2]) / 2.0
+end
+
+results = Dir.mktmpdir('zstd-ruby-variants') do |tmp|
+  variants.map do |name, args|
+    dir = File.join(tmp, name)
+    FileUtils.mkdir_p(File.join(dir, 'zstd-ruby'))
+    built = Dir.chdir(dir) do
+      system(RbConfig.ruby, extconf, *args.split, out: File::NULL) &&
+        system(make, "-j#{Etc.nprocessors}", out: 'make.log', err: [:child, :out])
+    end
+    abort "#{name}: build failed\n#{File.readlines(File.join(dir, 'make.log')).last(20).join}" unless built
+
+    so = File.join(dir, 'zstd-ruby', "zstdruby.#{dlext}")
+    FileUtils.cp(File.join(dir, "zstdruby.#{dlext}"), so)
+    stripped = "#{so}.stripped"
+    stripped_size = system('strip', '-x', '-o', stripped, so, err: File::NULL) ? File.size(stripped) : nil
+
+    samples = Array.new(options[:runs]) do
+      IO.popen([RbConfig.ruby, '--disable-gems', '-I', dir, '-I', lib, '-e', probe], &:read).split.map(&:to_f)
+    end
+    {
+      variant: name,
+      extconf_args: args,
+      so_bytes: File.size(so),
+      stripped_bytes: stripped_size,
+      require_ms: (median(samples.map(&:first)) * 1000).round(3),
+      rss_kb: median(samples.map(&:last)).round,
+    }
+  end
+end
+
+if options[:json]
+  puts JSON.pretty_generate(ruby: RUBY_DESCRIPTION, runs: options[:runs], results: results)
+else
+  puts format('%-24s %12s %14s %12s %10s', 'variant', '.so bytes', 'stripped bytes', 'require ms', 'RSS KB')
+  results.each do |r|
+    puts format('%-24s %12d %14s %12.3f %10d', r[:variant], r[:so_bytes], r[:stripped_bytes] || '-', r[:require_ms], r[:rss_kb])
+  end
+end
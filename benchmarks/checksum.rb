@@ -0,0 +1,21 @@
+require 'benchmark/ips'
+
+$LOAD_PATH.unshift '../lib'
+
+require 'zstd-ruby'
+
+sample_file_name = ARGV[0]
+data = File.read("./samples/#{sample_file_name}") * 10
+compressed = Zstd.compress(data, checksum: true)
+
+Benchmark.ips do |x|
+  x.report("verify_checksum: true") do
+    Zstd.decompress(compressed)
+  end
+
+  x.report("verify_checksum: false") do
+    Zstd.decompress(compressed, verify_checksum: false)
+  end
+
+  x.compare!
+end
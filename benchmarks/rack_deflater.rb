@@ -0,0 +1,96 @@
+$LOAD_PATH.unshift File.expand_path('../lib', __dir__)
+
+require 'json'
+require 'optparse'
+require 'zlib'
+require 'zstd-ruby'
+require 'zstd-ruby/rack'
+require_relative 'suite/corpus'
+
+# CPU time per response byte of Zstd::Rack::Deflater versus Rack::Deflater on a chunked body.
+# Without the rack gem, Rack::Deflater is stood in for by the same Zlib::GzipWriter loop it runs
+# (gzip at the default level, flushed after each chunk).
+# Usage:
+#   ruby rack_deflater.rb
+#   ruby rack_deflater.rb --corpus logs --size 1048576 --chunk 4096 --requests 200 --json
+
+options = { corpus: 'json', size: 256 * 1024, chunk: 16 * 1024, requests: 100, json: false }
+OptionParser.new do |opts|
+  opts.on('--corpus KIND', Zstd::Bench::Corpus::KINDS) { |v| options[:corpus] = v }
+  opts.on('--size BYTES', Integer, 'response size') { |v| options[:size] = v }
+  opts.on('--chunk BYTES', Integer, 'body chunk size') { |v| options[:chunk] = v }
+  opts.on('--requests N', Integer) { |v| options[:requests] = v }
+  opts.on('--json', 'print results as JSON') { options[:json] = true }
+end.parse!
+
+data = Zstd::Bench::Corpus.generate(options[:corpus], options[:size])
+chunks = (0...data.bytesize).step(options[:chunk]).map { |pos| data.byteslice(pos, options[:chunk]) }
+app = ->(_env) { [200, { 'content-type' => 'application/json' }, chunks] }
+
+begin
+  require 'rack'
+  require 'rack/deflater'
+  gzip = ['Rack::Deflater', Rack::Deflater.new(app), 'gzip']
+rescue LoadError
+  # collects what GzipWriter writes, as Rack::Deflater::GzipStream yields it
+  parts_io = Struct.new(:parts) do
+    def write(data)
+      parts << data.dup
+      data.bytesize
+    end
+  end
+  stand_in = lambda do |env|
+    status, headers, body = app.call(env)
+    parts = []
+    writer = Zlib::GzipWriter.new(parts_io.new(parts))
+    body.each do |chunk|
+      writer.write(chunk)
+      writer.flush
+    end
+    writer.close
+    [status, headers.merge('content-encoding' => 'gzip'), parts]
+  end
+  gzip = ['gzip (Rack::Deflater stand-in)', stand_in, 'gzip']
+end
+
+middlewares = [
+  gzip,
+  ['Zstd::Rack::Deflater level 1', Zstd::Rack::Deflater.new(app, level: 1), 'zstd'],
+  ['Zstd::Rack::Deflater level 3', Zstd::Rack::Deflater.new(app), 'zstd'],
+  ['Zstd::Rack::Deflater sync: false', Zstd::Rack::Deflater.new(app, sync: false), 'zstd'],
+]
+
+def cpu_time
+  Process.clock_gettime(Process::CLOCK_PROCESS_CPUTIME_ID)
+end
+
+results = middlewares.map do |label, middleware, encoding|
+  env = { 'REQUEST_METHOD' => 'GET', 'HTTP_ACCEPT_ENCODING' => encoding }
+  run = lambda do
+    _, headers, body = middleware.call(env.dup)
+    raise "#{label} did not compress" unless headers['content-encoding'] == encoding
+    size = 0
+    body.each { |part| size += part.bytesize }
+    body.close if body.respond_to?(:close)
+    size
+  end
+  run.call # warm up
+  start = cpu_time
+  compressed = Array.new(options[:requests]) { run.call }.sum
+  elapsed = cpu_time - start
+  {
+    middleware: label,
+    ratio: (options[:requests] * data.bytesize).fdiv(compressed).round(3),
+    cpu_ns_per_byte: (elapsed * 1e9 / (options[:requests] * data.bytesize)).round(2),
+    mb_per_cpu_sec: (options[:requests] * data.bytesize / elapsed / 1e6).round(1),
+  }
+end
+
+if options[:json]
+  puts JSON.pretty_generate(ruby: RUBY_DESCRIPTION, options: options, results: results)
+else
+  puts format('%-34s %8s %12s %14s', 'middleware', 'ratio', 'CPU ns/B', 'MB/CPU s')
+  results.each do |r|
+    puts format('%-34s %8.3f %12.2f %14.1f', r[:middleware], r[:ratio], r[:cpu_ns_per_byte], r[:mb_per_cpu_sec])
+  end
+end
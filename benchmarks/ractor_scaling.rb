@@ -0,0 +1,63 @@
+$LOAD_PATH.unshift File.expand_path('../lib', __dir__)
+
+require 'etc'
+require 'json'
+require 'optparse'
+require 'zstd-ruby'
+require_relative 'suite/corpus'
+
+# Compression throughput of N Ractors versus N threads calling Zstd.compress on small payloads,
+# where the per-call GVL release/acquire and Ruby-side work dominate. Needs Ruby 3.0 or later.
+# Usage:
+#   ruby ractor_scaling.rb
+#   ruby ractor_scaling.rb --size 4096 --calls 20000 --max 8 --dict --json
+
+options = { size: 16 * 1024, calls: 5000, max: Etc.nprocessors, level: 3, dict: false, json: false }
+OptionParser.new do |opts|
+  opts.on('--size BYTES', Integer, 'payload size') { |v| options[:size] = v }
+  opts.on('--calls N', Integer, 'calls per Ractor or thread') { |v| options[:calls] = v }
+  opts.on('--max N', Integer, 'largest number of Ractors and threads') { |v| options[:max] = v }
+  opts.on('--level LEVEL', Integer) { |v| options[:level] = v }
+  opts.on('--dict', 'compress with a CDict shared by all Ractors') { options[:dict] = true }
+  opts.on('--json', 'print results as JSON') { options[:json] = true }
+end.parse!
+
+Warning[:experimental] = false
+data = Ractor.make_shareable(Zstd::Bench::Corpus.generate('json', options[:size]))
+cdict = options[:dict] ? Zstd::CDict.new(Zstd::Bench::Corpus.dictionary('json'), options[:level]) : nil
+level = options[:level]
+calls = options[:calls]
+
+def compress_calls(input, dict, level, calls)
+  calls.times { dict ? Zstd.compress(input, dict: dict) : Zstd.compress(input, level: level) }
+end
+
+runners = {
+  threads: ->(n) { Array.new(n) { Thread.new { compress_calls(data, cdict, level, calls) } }.each(&:join) },
+  ractors: lambda do |n|
+    ractors = Array.new(n) { Ractor.new(data, cdict, level, calls) { |*args| compress_calls(*args) } }
+    # Ractor#take was replaced at Ruby 3.5.
+    ractors.each { |r| r.respond_to?(:take) ? r.take : r.value }
+  end,
+}
+
+counts = [1, 2, 4, 8, 16].select { |n| n <= options[:max] } | [options[:max]]
+results = counts.flat_map do |n|
+  runners.map do |kind, runner|
+    runner.call(1) # warm up
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    runner.call(n)
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+    { kind: kind, n: n, calls_per_sec: (n * calls / elapsed).round, mb_per_sec: (n * calls * data.bytesize / elapsed / 1e6).round(1) }
+  end
+end
+
+if options[:json]
+  puts JSON.pretty_generate(ruby: RUBY_DESCRIPTION, cpus: Etc.nprocessors, options: options, results: results)
+else
+  puts format('%-8s %4s %14s %10s %10s', 'kind', 'n', 'calls/s', 'MB/s', 'speedup')
+  results.each do |r|
+    base = results.find { |b| b[:kind] == r[:kind] && b[:n] == 1 }
+    puts format('%-8s %4d %14d %10.1f %9.2fx', r[:kind], r[:n], r[:calls_per_sec], r[:mb_per_sec], r[:calls_per_sec].fdiv(base[:calls_per_sec]))
+  end
+end
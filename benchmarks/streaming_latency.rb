@@ -0,0 +1,37 @@
+$LOAD_PATH.unshift '../lib'
+
+require 'zstd-ruby'
+
+# Time-to-first-decoded-byte of a flushed StreamingCompress message received in MTU-sized packets.
+# Usage: ruby streaming_latency.rb city.json
+
+MTU = 1400
+ITERATIONS = (ENV['ITERATIONS'] || 100).to_i
+
+sample_file_name = ARGV[0]
+message = File.read("./samples/#{sample_file_name}").byteslice(0, 256 * 1024)
+
+def first_byte(packets)
+  decompressor = Zstd::StreamingDecompress.new
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  packets.each_with_index do |packet, i|
+    unless decompressor.decompress(packet).empty?
+      return [i + 1, Process.clock_gettime(Process::CLOCK_MONOTONIC) - start]
+    end
+  end
+end
+
+[
+  ['default', {}],
+  ['latency: :low', { latency: :low }],
+].each do |label, opts|
+  stream = Zstd::StreamingCompress.new(**opts)
+  stream << message
+  compressed = stream.flush
+  packets = (0...compressed.bytesize).step(MTU).map { |pos| compressed.byteslice(pos, MTU) }
+
+  results = ITERATIONS.times.map { first_byte(packets) }
+  seconds = results.sum { |_, sec| sec } / ITERATIONS
+  puts format("%-26s compressed: %7d bytes  packets until first byte: %3d / %3d  decode time to first byte: %.1f us",
+              label, compressed.bytesize, results[0][0], packets.size, seconds * 1_000_000)
+end
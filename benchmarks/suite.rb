@@ -0,0 +1,174 @@
+$LOAD_PATH.unshift File.expand_path('../lib', __dir__)
+
+require 'etc'
+require 'json'
+require 'optparse'
+require 'time'
+require 'zstd-ruby'
+require_relative 'suite/corpus'
+require_relative 'suite/measure'
+
+# Reproducible benchmark matrix: corpus x size x level x dictionary, parallel threads and streaming chunk sizes.
+# Usage:
+#   ruby suite.rb --output results/suite.json
+#   ruby suite.rb --quick --baseline results/suite.json
+
+SIZE_UNITS = { '' => 1, 'K' => 1024, 'M' => 1024**2, 'G' => 1024**3 }.freeze
+
+def parse_size(str)
+  m = /\A(\d+)([KMG]?)\z/i.match(str) or raise OptionParser::InvalidArgument, str
+  m[1].to_i * SIZE_UNITS[m[2].upcase]
+end
+
+def format_size(size)
+  unit = SIZE_UNITS.keys.reverse.find { |u| size >= SIZE_UNITS[u] && size % SIZE_UNITS[u] == 0 }
+  "#{size / SIZE_UNITS[unit]}#{unit}"
+end
+
+options = {
+  corpus: Zstd::Bench::Corpus::KINDS,
+  sizes: %w[100 1K 16K 256K 4M 64M].map { |s| parse_size(s) },
+  levels: [-1, 1, 3, 9, 19],
+  threads: [1, 4],
+  chunk_sizes: [1024, 64 * 1024, 1024 * 1024],
+  dict_max_size: 64 * 1024,
+  min_time: 0.5,
+  threshold: 0.1,
+  filter: nil,
+  output: nil,
+  baseline: nil,
+}
+
+OptionParser.new do |opts|
+  opts.on('--quick', 'small matrix for CI') do
+    options.merge!(sizes: [100, 16 * 1024, 1024 * 1024], levels: [1, 3], threads: [1, 2], chunk_sizes: [64 * 1024], min_time: 0.1)
+  end
+  opts.on('--full', 'include 256M and 1G payloads') { options[:sizes] += [256 * 1024**2, 1024**3] }
+  opts.on('--corpus LIST', Array) { |v| options[:corpus] = v }
+  opts.on('--sizes LIST', Array, 'e.g. 100,1K,1M,1G') { |v| options[:sizes] = v.map { |s| parse_size(s) } }
+  opts.on('--levels LIST', Array) { |v| options[:levels] = v.map { |l| Integer(l) } }
+  opts.on('--threads LIST', Array) { |v| options[:threads] = v.map { |t| Integer(t) } }
+  opts.on('--chunk-sizes LIST', Array) { |v| options[:chunk_sizes] = v.map { |s| parse_size(s) } }
+  opts.on('--min-time SECONDS', Float) { |v| options[:min_time] = v }
+  opts.on('--filter REGEXP', 'only run cases whose name matches') { |v| options[:filter] = Regexp.new(v) }
+  opts.on('--output FILE', 'write results as JSON') { |v| options[:output] = v }
+  opts.on('--baseline FILE', 'compare with a previous --output') { |v| options[:baseline] = v }
+  opts.on('--threshold RATIO', Float, 'allowed throughput loss (default 0.1)') { |v| options[:threshold] = v }
+end.parse!
+
+results = []
+
+run_case = lambda do |name, params, size, compress, decompress|
+  return if options[:filter] && name !~ options[:filter]
+  compressed = compress.call
+  raise "#{name}: roundtrip failed" unless decompress.call(compressed).bytesize == size
+  compress_sec, compress_allocs = Zstd::Bench::Measure.run(options[:min_time]) { compress.call }
+  decompress_sec, decompress_allocs = Zstd::Bench::Measure.run(options[:min_time]) { decompress.call(compressed) }
+  rss, peak_rss = Zstd::Bench::Measure.rss
+  result = params.merge(
+    name: name,
+    size: size,
+    compressed_size: compressed.bytesize,
+    ratio: (size.fdiv(compressed.bytesize)).round(4),
+    compress_mb_s: (size / compress_sec / 1_000_000).round(2),
+    decompress_mb_s: (size / decompress_sec / 1_000_000).round(2),
+    compress_allocations: compress_allocs.round(1),
+    decompress_allocations: decompress_allocs.round(1),
+    rss_kb: rss,
+    peak_rss_kb: peak_rss,
+  )
+  results << result
+  $stderr.puts format('%-48s ratio %8.3f  compress %9.2f MB/s  decompress %9.2f MB/s  allocs %6.1f/%6.1f',
+                      name, result[:ratio], result[:compress_mb_s], result[:decompress_mb_s],
+                      result[:compress_allocations], result[:decompress_allocations])
+end
+
+options[:corpus].each do |kind|
+  dict = Zstd::Bench::Corpus.dictionary(kind)
+  cdicts = Hash.new { |h, level| h[level] = Zstd::CDict.new(dict, level) }
+  ddict = Zstd::DDict.new(dict)
+
+  options[:sizes].each do |size|
+    data = Zstd::Bench::Corpus.generate(kind, size)
+    prefix = "#{kind}/#{format_size(size)}"
+
+    options[:levels].each do |level|
+      run_case.call("#{prefix}/level=#{level}", { corpus: kind, level: level, dict: false, mode: 'oneshot' }, size,
+                    -> { Zstd.compress(data, level: level) },
+                    ->(c) { Zstd.decompress(c) })
+      next if size > options[:dict_max_size]
+      run_case.call("#{prefix}/level=#{level}/dict", { corpus: kind, level: level, dict: true, mode: 'oneshot' }, size,
+                    -> { Zstd.compress(data, dict: cdicts[level]) },
+                    ->(c) { Zstd.decompress(c, dict: ddict) })
+    end
+
+    options[:threads].each do |threads|
+      next if threads < 2 || size < 4 * 1024 * 1024
+      run_case.call("#{prefix}/parallel=#{threads}", { corpus: kind, level: 3, dict: false, mode: 'parallel', threads: threads }, size,
+                    -> { Zstd.compress(data, parallel: threads, frame_size: 1024 * 1024) },
+                    ->(c) { Zstd.decompress(c, parallel: threads) })
+    end
+
+    options[:chunk_sizes].each do |chunk_size|
+      next if chunk_size >= size
+      run_case.call("#{prefix}/streaming=#{format_size(chunk_size)}", { corpus: kind, level: 3, dict: false, mode: 'streaming', chunk_size: chunk_size }, size,
+                    lambda {
+                      stream = Zstd::StreamingCompress.new
+                      out = ''.b
+                      (0...size).step(chunk_size) { |pos| out << stream.compress(data.byteslice(pos, chunk_size)) }
+                      out << stream.finish
+                    },
+                    lambda { |c|
+                      stream = Zstd::StreamingDecompress.new
+                      out = ''.b
+                      (0...c.bytesize).step(chunk_size) { |pos| out << stream.decompress(c.byteslice(pos, chunk_size)) }
+                      out
+                    })
+    end
+  end
+end
+
+report = {
+  created_at: Time.now.utc.iso8601,
+  ruby: RUBY_DESCRIPTION,
+  zstd: Zstd.zstd_version,
+  gem: Zstd::VERSION,
+  processors: Etc.nprocessors,
+  min_time: options[:min_time],
+  results: results,
+}
+
+if options[:output]
+  File.write(options[:output], JSON.pretty_generate(report))
+  $stderr.puts "wrote #{options[:output]}"
+end
+
+exit unless options[:baseline]
+
+baseline = JSON.parse(File.read(options[:baseline]), symbolize_names: true)
+baseline_results = baseline[:results].to_h { |r| [r[:name], r] }
+regressions = []
+results.each do |current|
+  base = baseline_results[current[:name]] or next
+  %i[compress_mb_s decompress_mb_s].each do |key|
+    if current[key] < base[key] * (1 - options[:threshold])
+      regressions << format('%-48s %-16s %9.2f -> %9.2f (%+.1f%%)', current[:name], key, base[key], current[key], (current[key] / base[key] - 1) * 100)
+    end
+  end
+  if current[:ratio] < base[:ratio] * 0.999
+    regressions << format('%-48s %-16s %9.3f -> %9.3f', current[:name], 'ratio', base[:ratio], current[:ratio])
+  end
+  %i[compress_allocations decompress_allocations].each do |key|
+    if current[key] > base[key] + 1
+      regressions << format('%-48s %-16s %9.1f -> %9.1f', current[:name], key, base[key], current[key])
+    end
+  end
+end
+
+if regressions.empty?
+  $stderr.puts "no regressions against #{options[:baseline]} (#{baseline[:created_at]})"
+else
+  $stderr.puts "regressions against #{options[:baseline]} (#{baseline[:created_at]}):"
+  regressions.each { |line| $stderr.puts "  #{line}" }
+  exit 1
+end
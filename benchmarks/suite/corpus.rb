@@ -0,0 +1,69 @@
+require 'json'
+
+module Zstd
+  module Bench
+    # Deterministic corpora. The same kind, size and seed always produce the same bytes.
+    module Corpus
+      KINDS = %w[json logs binary random].freeze
+      BLOCK_SIZE = 1 << 20
+
+      module_function
+
+      def generate(kind, size, seed: 0)
+        block = block(kind, [size, BLOCK_SIZE].min, seed)
+        data = block * (size / block.bytesize + 1)
+        data.byteslice(0, size)
+      end
+
+      # A raw content dictionary: same distribution as the corpus, different seed
+      def dictionary(kind, size: 16 * 1024)
+        block(kind, size, 1_000_003)
+      end
+
+      def block(kind, size, seed)
+        rng = Random.new(seed)
+        out = ''.b
+        case kind
+        when 'json'
+          out << json_record(rng) << "\n" while out.bytesize < size
+        when 'logs'
+          out << log_line(rng) << "\n" while out.bytesize < size
+        when 'binary'
+          # little endian records with slowly changing fields, like metrics or columnar data
+          ts = 1_700_000_000
+          while out.bytesize < size
+            ts += rng.rand(3)
+            out << [ts, rng.rand(1000), rng.rand * 100, rng.rand(4)].pack('Q<L<eC')
+          end
+        when 'random'
+          out << rng.bytes(size)
+        else
+          raise ArgumentError, "unknown corpus: #{kind}"
+        end
+        out.byteslice(0, size)
+      end
+
+      WORDS = %w[alpha bravo charlie delta echo foxtrot golf hotel india juliett kilo lima mike november oscar papa].freeze
+      LEVELS = %w[DEBUG INFO INFO INFO WARN ERROR].freeze
+      PATHS = %w[/ /login /api/v1/users /api/v1/orders /static/app.js /health].freeze
+
+      def json_record(rng)
+        JSON.generate(
+          id: rng.rand(1_000_000),
+          name: "#{WORDS[rng.rand(WORDS.size)]} #{WORDS[rng.rand(WORDS.size)]}",
+          active: rng.rand(2) == 1,
+          score: (rng.rand * 100).round(2),
+          tags: Array.new(rng.rand(4)) { WORDS[rng.rand(WORDS.size)] },
+        )
+      end
+
+      def log_line(rng)
+        format('2026-10-%02d %02d:%02d:%02d.%03d %-5s [%s] %s %s %d %dms',
+               rng.rand(1..28), rng.rand(24), rng.rand(60), rng.rand(60), rng.rand(1000),
+               LEVELS[rng.rand(LEVELS.size)], WORDS[rng.rand(WORDS.size)],
+               %w[GET POST GET GET PUT][rng.rand(5)], PATHS[rng.rand(PATHS.size)],
+               [200, 200, 200, 304, 404, 500][rng.rand(6)], rng.rand(500))
+      end
+    end
+  end
+end
@@ -0,0 +1,44 @@
+module Zstd
+  module Bench
+    module Measure
+      module_function
+
+      # Runs the block in `rounds` rounds of min_time / rounds seconds (each at least once) and keeps the
+      # fastest round, which filters out noise from other processes.
+      # Returns seconds per iteration and Ruby objects allocated per iteration.
+      def run(min_time, rounds: 3)
+        yield # warm up
+        GC.start
+        best = Float::INFINITY
+        allocations = 0
+        total = 0
+        rounds.times do
+          iterations = 0
+          allocated = GC.stat(:total_allocated_objects)
+          start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+          elapsed = 0.0
+          while iterations == 0 || elapsed < min_time / rounds
+            yield
+            iterations += 1
+            elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+          end
+          allocations += GC.stat(:total_allocated_objects) - allocated
+          total += iterations
+          best = [best, elapsed / iterations].min
+        end
+        [best, allocations.fdiv(total)]
+      end
+
+      # [current, peak] resident set size in KB
+      def rss
+        if File.readable?('/proc/self/status')
+          status = File.read('/proc/self/status')
+          [status[/^VmRSS:\s+(\d+)/, 1].to_i, status[/^VmHWM:\s+(\d+)/, 1].to_i]
+        else
+          current = `ps -o rss= -p #{Process.pid}`.to_i
+          [current, current]
+        end
+      end
+    end
+  end
+end
@@ -1,7 +1,10 @@
 require 'sinatra'
 require 'zstd-ruby'
+require 'zstd-ruby/rack'
+
+# responses are compressed for clients sending `Accept-Encoding: zstd`
+use Zstd::Rack::Deflater, min_size: 0
 
 get '/' do
-  headers["Content-Encoding"] = "zstd"
-  Zstd.compress('Hello world!')
+  'Hello world!'
 end
@@ -0,0 +1,538 @@
+#include "common.h"
+#include "threading.h"
+#include "pool.h"
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "ruby/io.h"
+
+extern VALUE rb_mZstd;
+size_t zstd_decompress_to_heap(ZSTD_DCtx* dctx, const char* src, size_t src_size, char** dst, size_t* dst_size);
+
+/*
+ * Zstd.compress_async / Zstd.decompress_async run on a pool of native threads (libzstd's POOL)
+ * without the GVL. Jobs stay on a pending list until they are done. The list and the futures are
+ * marked by GC, so input and output strings stay pinned while a worker uses them.
+ * A job is shared by its future and the pending list and freed when both released it.
+ */
+
+#define ASYNC_QUEUE_SIZE 64 /* submissions beyond this wait for a worker, without the GVL */
+#define ASYNC_DEFAULT_THREADS 4
+
+enum async_kind { ASYNC_COMPRESS, ASYNC_DECOMPRESS };
+
+struct async_job_t {
+  ZSTD_pthread_mutex_t mutex;
+  int refs;
+  int done;
+  int forked;         /* failed in a forked child, whose pool does not run the parent's jobs */
+  int notify_fd;      /* write end of the future's completion pipe, -1 until Future#to_io */
+  VALUE io;           /* read end of that pipe */
+  enum async_kind kind;
+  VALUE input;
+  VALUE output;       /* nil when decompressing frames without a content size */
+  VALUE dict;         /* CDict/DDict referenced by the context */
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  ZSTD_CCtx* cctx;
+#endif
+  ZSTD_DCtx* dctx;
+  const char* src;
+  size_t src_size;
+  char* dst;
+  size_t dst_size;
+  char* heap_dst;
+  size_t ret;
+  struct async_job_t* next;
+};
+
+struct future_t {
+  struct async_job_t* job;
+  VALUE io;
+  VALUE result;
+};
+
+static ZSTD_pthread_mutex_t async_mutex;
+static struct async_job_t* async_pending = NULL;
+static POOL_ctx* async_pool = NULL;
+static rb_pid_t async_pool_pid = 0;
+static size_t async_threads = 0;
+static VALUE async_pending_holder = Qnil;
+static VALUE cFuture;
+
+static void
+async_job_release(struct async_job_t* job)
+{
+  ZSTD_pthread_mutex_lock(&job->mutex);
+  int const refs = --job->refs;
+  ZSTD_pthread_mutex_unlock(&job->mutex);
+  if (refs > 0) {
+    return;
+  }
+  ZSTD_pthread_mutex_destroy(&job->mutex);
+  free(job->heap_dst);
+  xfree(job);
+}
+
+static int
+async_job_done(struct async_job_t* job)
+{
+  ZSTD_pthread_mutex_lock(&job->mutex);
+  int const done = job->done;
+  ZSTD_pthread_mutex_unlock(&job->mutex);
+  return done;
+}
+
+/* drops finished jobs from the pending list, which unpins their strings */
+static void
+async_sweep(void)
+{
+  struct async_job_t* released = NULL;
+  ZSTD_pthread_mutex_lock(&async_mutex);
+  struct async_job_t** link = &async_pending;
+  while (*link != NULL) {
+    struct async_job_t* const job = *link;
+    if (async_job_done(job)) {
+      *link = job->next;
+      job->next = released;
+      released = job;
+    } else {
+      link = &job->next;
+    }
+  }
+  ZSTD_pthread_mutex_unlock(&async_mutex);
+  while (released != NULL) {
+    struct async_job_t* const next = released->next;
+    async_job_release(released);
+    released = next;
+  }
+}
+
+static void
+async_pending_mark(void* p)
+{
+  struct async_job_t* job = *(struct async_job_t**)p;
+  /* other Ractors are stopped during marking, and none holds async_mutex across a safepoint */
+  for (; job != NULL; job = job->next) {
+    rb_gc_mark(job->input);
+    rb_gc_mark(job->output);
+    rb_gc_mark(job->dict);
+    rb_gc_mark(job->io);
+  }
+}
+
+static const rb_data_type_t async_pending_type = {
+  "zstd_async_pending",
+  { async_pending_mark, NULL, NULL, },
+  0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static void
+async_notify(struct async_job_t* job)
+{
+  if (job->notify_fd >= 0) {
+    if (write(job->notify_fd, "", 1) < 0) {
+      /* the reader is gone or already readable */
+    }
+    close(job->notify_fd);
+    job->notify_fd = -1;
+  }
+}
+
+static void
+async_work(void* opaque)
+{
+  struct async_job_t* job = opaque;
+  if (job->kind == ASYNC_COMPRESS) {
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+    job->ret = ZSTD_compress2(job->cctx, job->dst, job->dst_size, job->src, job->src_size);
+    ZSTD_freeCCtx(job->cctx);
+    job->cctx = NULL;
+#endif
+  } else {
+    if (job->dst != NULL) {
+      job->ret = ZSTD_decompressDCtx(job->dctx, job->dst, job->dst_size, job->src, job->src_size);
+    } else {
+      job->ret = zstd_decompress_to_heap(job->dctx, job->src, job->src_size, &job->heap_dst, &job->dst_size);
+    }
+    ZSTD_freeDCtx(job->dctx);
+    job->dctx = NULL;
+  }
+
+  ZSTD_pthread_mutex_lock(&job->mutex);
+  job->done = 1;
+  async_notify(job);
+  ZSTD_pthread_mutex_unlock(&job->mutex);
+}
+
+static size_t
+async_default_threads(void)
+{
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+  long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 0) {
+    return (size_t)cpus;
+  }
+#endif
+  return ASYNC_DEFAULT_THREADS;
+}
+
+/*
+ * called with async_mutex held. Zstd.async_after_fork resets the pool in a forked child; the pid
+ * check covers Rubies without Process._fork, where pending futures of the parent are not failed.
+ */
+static POOL_ctx*
+async_get_pool(void)
+{
+  if (async_pool == NULL || async_pool_pid != getpid()) {
+    if (async_threads == 0) {
+      async_threads = async_default_threads();
+    }
+    async_pool = POOL_create(async_threads, ASYNC_QUEUE_SIZE);
+    async_pool_pid = getpid();
+  }
+  return async_pool;
+}
+
+struct async_submit_t {
+  POOL_ctx* pool;
+  struct async_job_t* job;
+};
+
+static void*
+async_submit_without_gvl(void* arg)
+{
+  struct async_submit_t* submit = arg;
+  POOL_add(submit->pool, async_work, submit->job);
+  return NULL;
+}
+
+static void
+future_mark(void* p)
+{
+  struct future_t* future = p;
+  rb_gc_mark(future->io);
+  rb_gc_mark(future->result);
+  /* the output must outlive the job's stay on the pending list until Future#value takes it */
+  if (future->job != NULL) {
+    rb_gc_mark(future->job->output);
+    rb_gc_mark(future->job->dict);
+  }
+}
+
+static void
+future_free(void* p)
+{
+  struct future_t* future = p;
+  if (future->job != NULL) {
+    ZSTD_pthread_mutex_lock(&future->job->mutex);
+    if (future->job->notify_fd >= 0) {
+      close(future->job->notify_fd);
+      future->job->notify_fd = -1;
+    }
+    ZSTD_pthread_mutex_unlock(&future->job->mutex);
+    async_job_release(future->job);
+  }
+  xfree(future);
+}
+
+static size_t
+future_memsize(const void* p)
+{
+  return sizeof(struct future_t) + sizeof(struct async_job_t);
+}
+
+static const rb_data_type_t future_type = {
+  "Zstd::Future",
+  { future_mark, future_free, future_memsize, },
+  0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE
+async_submit(struct async_job_t* job)
+{
+  struct future_t* future;
+  VALUE obj = TypedData_Make_Struct(cFuture, struct future_t, &future_type, future);
+  future->io = Qnil;
+  future->result = Qnil;
+
+  ZSTD_pthread_mutex_init(&job->mutex, NULL);
+  job->refs = 2;
+  job->notify_fd = -1;
+  future->job = job;
+
+  async_sweep();
+  ZSTD_pthread_mutex_lock(&async_mutex);
+  struct async_submit_t submit = { async_get_pool(), job };
+  job->next = async_pending;
+  async_pending = job;
+  ZSTD_pthread_mutex_unlock(&async_mutex);
+  if (submit.pool == NULL) {
+    ZSTD_pthread_mutex_lock(&job->mutex);
+    job->ret = (size_t)-ZSTD_error_memory_allocation;
+    job->done = 1;
+    ZSTD_pthread_mutex_unlock(&job->mutex);
+    return obj;
+  }
+#ifdef HAVE_RUBY_THREAD_H
+  rb_thread_call_without_gvl(async_submit_without_gvl, &submit, NULL, NULL);
+#else
+  async_submit_without_gvl(&submit);
+#endif
+  return obj;
+}
+
+static struct async_job_t*
+async_job_new(enum async_kind kind, VALUE input_value, VALUE dict)
+{
+  struct async_job_t* job = ZALLOC(struct async_job_t);
+  job->kind = kind;
+  job->input = input_value;
+  job->output = Qnil;
+  job->dict = dict == Qundef ? Qnil : dict;
+  job->io = Qnil;
+  return job;
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+static VALUE
+rb_compress_async(int argc, VALUE *argv, VALUE self)
+{
+  VALUE input_value;
+  VALUE kwargs;
+  rb_scan_args(argc, argv, "10:", &input_value, &kwargs);
+
+  ID kwargs_keys[3];
+  kwargs_keys[0] = rb_intern("level");
+  kwargs_keys[1] = rb_intern("dict");
+  kwargs_keys[2] = rb_intern("checksum");
+  VALUE kwargs_values[3];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 3, kwargs_values);
+
+  StringValue(input_value);
+  input_value = rb_str_new_frozen(input_value);
+  struct compress_options options = { kwargs_values[0], kwargs_values[1], kwargs_values[2] };
+
+  ZSTD_CCtx* const ctx = zstd_ruby_create_cctx();
+  if (ctx == NULL) {
+    rb_raise(rb_eRuntimeError, "%s", "ZSTD_createCCtx error");
+  }
+  set_compress_options(ctx, &options);
+  VALUE output = rb_str_new(NULL, ZSTD_compressBound(RSTRING_LEN(input_value)));
+
+  /* buffers are taken after the last Ruby allocation, and stay pinned by the pending list */
+  struct async_job_t* job = async_job_new(ASYNC_COMPRESS, input_value, kwargs_values[1]);
+  job->output = output;
+  job->cctx = ctx;
+  job->src = RSTRING_PTR(input_value);
+  job->src_size = RSTRING_LEN(input_value);
+  job->dst = RSTRING_PTR(output);
+  job->dst_size = RSTRING_LEN(output);
+  return async_submit(job);
+}
+#endif
+
+static VALUE
+rb_decompress_async(int argc, VALUE *argv, VALUE self)
+{
+  VALUE input_value;
+  VALUE kwargs;
+  rb_scan_args(argc, argv, "10:", &input_value, &kwargs);
+
+  ID kwargs_keys[2];
+  kwargs_keys[0] = rb_intern("dict");
+  kwargs_keys[1] = rb_intern("verify_checksum");
+  VALUE kwargs_values[2];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 2, kwargs_values);
+
+  StringValue(input_value);
+  input_value = rb_str_new_frozen(input_value);
+  struct decompress_options options = { kwargs_values[0], kwargs_values[1] };
+
+  unsigned long long const content_size = zstd_ruby_trusted_content_size(RSTRING_PTR(input_value), RSTRING_LEN(input_value));
+  if (content_size == ZSTD_CONTENTSIZE_ERROR) {
+    rb_raise(rb_eRuntimeError, "%s", "not a zstd frame");
+  }
+  /* frames without a plausible content size are decoded into a growable heap buffer by the worker */
+  VALUE output = content_size == ZSTD_CONTENTSIZE_UNKNOWN ? Qnil : rb_str_new(NULL, content_size);
+
+  ZSTD_DCtx* const dctx = zstd_ruby_create_dctx();
+  if (dctx == NULL) {
+    rb_raise(rb_eRuntimeError, "%s", "ZSTD_createDCtx error");
+  }
+  set_decompress_options(dctx, &options);
+
+  struct async_job_t* job = async_job_new(ASYNC_DECOMPRESS, input_value, kwargs_values[0]);
+  job->output = output;
+  job->dctx = dctx;
+  job->src = RSTRING_PTR(input_value);
+  job->src_size = RSTRING_LEN(input_value);
+  job->dst = NIL_P(output) ? NULL : RSTRING_PTR(output);
+  job->dst_size = NIL_P(output) ? 0 : RSTRING_LEN(output);
+  return async_submit(job);
+}
+
+static VALUE
+rb_future_ready_p(VALUE self)
+{
+  struct future_t* future;
+  TypedData_Get_Struct(self, struct future_t, &future_type, future);
+  return async_job_done(future->job) ? Qtrue : Qfalse;
+}
+
+/* the read end of a pipe that becomes readable once the result is ready */
+static VALUE
+rb_future_to_io(VALUE self)
+{
+  struct future_t* future;
+  TypedData_Get_Struct(self, struct future_t, &future_type, future);
+  if (!NIL_P(future->io)) {
+    return future->io;
+  }
+
+  int fds[2];
+  if (rb_pipe(fds) < 0) {
+    rb_sys_fail("pipe");
+  }
+  struct async_job_t* const job = future->job;
+  ZSTD_pthread_mutex_lock(&job->mutex);
+  job->notify_fd = fds[1];
+  if (job->done) {
+    async_notify(job);
+  }
+  ZSTD_pthread_mutex_unlock(&job->mutex);
+  RB_OBJ_WRITE(self, &future->io, rb_funcall(rb_cIO, rb_intern("for_fd"), 1, INT2FIX(fds[0])));
+  job->io = future->io;
+  return future->io;
+}
+
+/* called by Future#value once the job is done */
+static VALUE
+rb_future_result(VALUE self)
+{
+  struct future_t* future;
+  TypedData_Get_Struct(self, struct future_t, &future_type, future);
+  if (!NIL_P(future->result)) {
+    return future->result;
+  }
+  struct async_job_t* const job = future->job;
+  if (!async_job_done(job)) {
+    rb_raise(rb_eRuntimeError, "%s", "the result is not ready");
+  }
+  if (job->forked) {
+    rb_raise(rb_eRuntimeError, "%s", "forked while pending");
+  }
+  if (ZSTD_isError(job->ret)) {
+    rb_raise(rb_eRuntimeError, "%s error error code: %s", job->kind == ASYNC_COMPRESS ? "compress" : "decompress", ZSTD_getErrorName(job->ret));
+  }
+
+  VALUE result = job->output;
+  if (NIL_P(result)) {
+    result = rb_str_new(job->heap_dst, job->ret);
+    free(job->heap_dst);
+    job->heap_dst = NULL;
+  } else {
+    rb_str_resize(result, job->ret);
+  }
+  RB_OBJ_WRITE(self, &future->result, result);
+  async_sweep();
+  return result;
+}
+
+/* the read end of a future's pipe gets a readable pipe of the child, the parent's pipe is left alone */
+static void
+async_notify_forked(struct async_job_t* job)
+{
+  if (job->notify_fd < 0) {
+    return;
+  }
+  close(job->notify_fd);
+  job->notify_fd = -1;
+  if (NIL_P(job->io) || RTEST(rb_funcall(job->io, rb_intern("closed?"), 0))) {
+    return;
+  }
+  int fds[2];
+  if (rb_pipe(fds) < 0) {
+    return;
+  }
+  if (rb_cloexec_dup2(fds[0], NUM2INT(rb_funcall(job->io, rb_intern("fileno"), 0))) >= 0 && write(fds[1], "", 1) < 0) {
+    /* the pipe is empty, so the write cannot fail */
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+/*
+ * Called in a forked child by lib/zstd-ruby/fork_hook.rb. The parent's workers do not exist there,
+ * so pending jobs would never complete: they fail with "forked while pending" instead, and the next
+ * submission starts a new pool. The parent's pool is dropped, not freed, because POOL_free would
+ * join threads that are gone; mutexes a worker held at fork time are initialized again.
+ */
+static VALUE
+rb_async_after_fork(VALUE self)
+{
+  ZSTD_pthread_mutex_init(&async_mutex, NULL);
+  async_pool = NULL;
+  async_pool_pid = 0;
+  for (struct async_job_t* job = async_pending; job != NULL; job = job->next) {
+    ZSTD_pthread_mutex_init(&job->mutex, NULL);
+    if (!job->done) {
+      /* a worker may have been using the contexts, they are leaked */
+      job->forked = 1;
+      job->done = 1;
+      async_notify_forked(job);
+    }
+  }
+  return Qnil;
+}
+
+static VALUE
+rb_async_threads(VALUE self)
+{
+  ZSTD_pthread_mutex_lock(&async_mutex);
+  if (async_threads == 0) {
+    async_threads = async_default_threads();
+  }
+  size_t const threads = async_threads;
+  ZSTD_pthread_mutex_unlock(&async_mutex);
+  return SIZET2NUM(threads);
+}
+
+static VALUE
+rb_set_async_threads(VALUE self, VALUE threads_value)
+{
+  int const threads = NUM2INT(threads_value);
+  if (threads < 1) {
+    rb_raise(rb_eArgError, "%s", "async_threads must be a positive Integer");
+  }
+  ZSTD_pthread_mutex_lock(&async_mutex);
+  async_threads = (size_t)threads;
+  int const failed = async_pool != NULL && async_pool_pid == getpid() && POOL_resize(async_pool, async_threads) != 0;
+  ZSTD_pthread_mutex_unlock(&async_mutex);
+  if (failed) {
+    rb_raise(rb_eRuntimeError, "%s", "POOL_resize failed");
+  }
+  return threads_value;
+}
+
+void
+zstd_ruby_async_init(void)
+{
+  ZSTD_pthread_mutex_init(&async_mutex, NULL);
+  /* GC does not call the mark function of a T_DATA without a data pointer */
+  async_pending_holder = TypedData_Wrap_Struct(0, &async_pending_type, &async_pending);
+  rb_gc_register_address(&async_pending_holder);
+
+  cFuture = rb_define_class_under(rb_mZstd, "Future", rb_cObject);
+  rb_undef_alloc_func(cFuture);
+  rb_define_method(cFuture, "ready?", rb_future_ready_p, 0);
+  rb_define_method(cFuture, "to_io", rb_future_to_io, 0);
+  rb_define_private_method(cFuture, "result", rb_future_result, 0);
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  rb_define_module_function(rb_mZstd, "compress_async", rb_compress_async, -1);
+#endif
+  rb_define_module_function(rb_mZstd, "decompress_async", rb_decompress_async, -1);
+  rb_define_module_function(rb_mZstd, "async_threads", rb_async_threads, 0);
+  rb_define_module_function(rb_mZstd, "async_threads=", rb_set_async_threads, 1);
+  rb_define_private_method(rb_singleton_class(rb_mZstd), "async_after_fork", rb_async_after_fork, 0);
+}
@@ -0,0 +1,645 @@
+#include "common.h"
+#include "threading.h"
+
+extern VALUE rb_mZstd;
+
+struct batch_worker_t;
+
+struct batch_t {
+  long count;
+  int n_workers;
+  ZSTD_CCtx** ctxs;
+  ZSTD_DCtx** dctxs;
+  const char** src;
+  size_t* src_size;
+  char** dst;
+  size_t* dst_size;
+  char** heap_dst;   /* decompress only: outputs of frames without a content size */
+  size_t* ret;
+  struct batch_worker_t* workers;
+  ZSTD_pthread_t* threads;
+};
+
+struct batch_worker_t {
+  struct batch_t* batch;
+  int worker;
+  int started;
+};
+
+static int
+batch_threads(VALUE threads_value, long count)
+{
+  int threads = 1;
+  if (threads_value != Qundef && threads_value != Qnil) {
+    threads = NUM2INT(threads_value);
+    if (threads < 1) {
+      rb_raise(rb_eArgError, "`threads:` must be a positive Integer");
+    }
+  }
+  if (threads > count) {
+    threads = count > 0 ? (int)count : 1;
+  }
+  return threads;
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+/* converted before any context exists: NUM2INT raising in set_compress_options would leak the context */
+static void
+batch_check_level(VALUE level_value)
+{
+  if (level_value != Qundef && level_value != Qnil) {
+    convert_compression_level(NULL, level_value);
+  }
+}
+#endif
+
+static void
+batch_alloc(struct batch_t* batch)
+{
+  long count = batch->count;
+  batch->workers = ALLOC_N(struct batch_worker_t, batch->n_workers);
+  batch->threads = ALLOC_N(ZSTD_pthread_t, batch->n_workers);
+  batch->src = ALLOC_N(const char*, count);
+  batch->src_size = ALLOC_N(size_t, count);
+  batch->dst = ALLOC_N(char*, count);
+  batch->dst_size = ALLOC_N(size_t, count);
+  batch->ret = ALLOC_N(size_t, count);
+}
+
+static VALUE
+batch_free(VALUE arg)
+{
+  struct batch_t* batch = (struct batch_t*)arg;
+  int i;
+  long j;
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  if (batch->ctxs) {
+    for (i = 0; i < batch->n_workers; i++) {
+      ZSTD_freeCCtx(batch->ctxs[i]);
+    }
+    xfree(batch->ctxs);
+  }
+#endif
+  if (batch->dctxs) {
+    for (i = 0; i < batch->n_workers; i++) {
+      ZSTD_freeDCtx(batch->dctxs[i]);
+    }
+    xfree(batch->dctxs);
+  }
+  if (batch->heap_dst) {
+    for (j = 0; j < batch->count; j++) {
+      free(batch->heap_dst[j]);
+    }
+    xfree(batch->heap_dst);
+  }
+  xfree(batch->workers);
+  xfree(batch->threads);
+  xfree(batch->src);
+  xfree(batch->src_size);
+  xfree(batch->dst);
+  xfree(batch->dst_size);
+  xfree(batch->ret);
+  return Qnil;
+}
+
+/* also used by async.c */
+size_t
+zstd_decompress_to_heap(ZSTD_DCtx* dctx, const char* src, size_t src_size, char** dst, size_t* dst_size)
+{
+  size_t cap = ZSTD_DStreamOutSize();
+  char* buf = malloc(cap);
+  ZSTD_inBuffer input = { src, src_size, 0 };
+  ZSTD_outBuffer output = { buf, cap, 0 };
+  size_t ret = 0;
+
+  if (buf == NULL) {
+    return (size_t)-ZSTD_error_memory_allocation;
+  }
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  for (;;) {
+    if (output.pos == output.size) {
+      char* grown = realloc(output.dst, output.size * 2);
+      if (grown == NULL) {
+        ret = (size_t)-ZSTD_error_memory_allocation;
+        break;
+      }
+      output.dst = grown;
+      output.size *= 2;
+    }
+    size_t const prev_in = input.pos, prev_out = output.pos;
+    ret = ZSTD_decompressStream(dctx, &output, &input);
+    if (ZSTD_isError(ret) || (ret == 0 && input.pos == input.size)) {
+      break;
+    }
+    if (input.pos == prev_in && output.pos == prev_out) {
+      break;
+    }
+  }
+  if (!ZSTD_isError(ret) && ret != 0) {
+    ret = (size_t)-ZSTD_error_srcSize_wrong;
+  }
+  *dst = output.dst;
+  *dst_size = output.pos;
+  return ZSTD_isError(ret) ? ret : output.pos;
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+static void*
+batch_compress_worker(void* arg)
+{
+  struct batch_worker_t* w = arg;
+  struct batch_t* batch = w->batch;
+  ZSTD_CCtx* ctx = batch->ctxs[w->worker];
+  long i;
+  for (i = w->worker; i < batch->count; i += batch->n_workers) {
+    batch->ret[i] = ZSTD_compress2(ctx, batch->dst[i], batch->dst_size[i], batch->src[i], batch->src_size[i]);
+  }
+  return NULL;
+}
+#endif
+
+static void*
+batch_decompress_worker(void* arg)
+{
+  struct batch_worker_t* w = arg;
+  struct batch_t* batch = w->batch;
+  ZSTD_DCtx* dctx = batch->dctxs[w->worker];
+  long i;
+  for (i = w->worker; i < batch->count; i += batch->n_workers) {
+    if (batch->dst[i] != NULL) {
+      batch->ret[i] = ZSTD_decompressDCtx(dctx, batch->dst[i], batch->dst_size[i], batch->src[i], batch->src_size[i]);
+    } else {
+      batch->ret[i] = zstd_decompress_to_heap(dctx, batch->src[i], batch->src_size[i], &batch->heap_dst[i], &batch->dst_size[i]);
+    }
+  }
+  return NULL;
+}
+
+/* Take buffer pointers only after every Ruby allocation is done, so GC cannot move embedded strings under us */
+static void
+batch_set_buffers(struct batch_t* batch, VALUE inputs, VALUE outputs)
+{
+  long i;
+  for (i = 0; i < batch->count; i++) {
+    VALUE input = RARRAY_AREF(inputs, i);
+    VALUE output = RARRAY_AREF(outputs, i);
+    batch->src[i] = RSTRING_PTR(input);
+    batch->src_size[i] = RSTRING_LEN(input);
+    batch->dst[i] = NIL_P(output) ? NULL : RSTRING_PTR(output);
+    batch->dst_size[i] = NIL_P(output) ? 0 : RSTRING_LEN(output);
+  }
+}
+
+struct batch_run_t {
+  struct batch_t* batch;
+  void* (*worker)(void*);
+};
+
+static void*
+batch_run_without_gvl(void* arg)
+{
+  struct batch_run_t* run = arg;
+  struct batch_t* batch = run->batch;
+  struct batch_worker_t* workers = batch->workers;
+  int i;
+
+  for (i = 0; i < batch->n_workers; i++) {
+    workers[i].batch = batch;
+    workers[i].worker = i;
+    workers[i].started = 0;
+  }
+  for (i = 1; i < batch->n_workers; i++) {
+    workers[i].started = ZSTD_pthread_create(&batch->threads[i], NULL, run->worker, &workers[i]) == 0;
+  }
+  run->worker(&workers[0]);
+  for (i = 1; i < batch->n_workers; i++) {
+    if (workers[i].started) {
+      ZSTD_pthread_join(batch->threads[i]);
+    } else {
+      /* fall back to the calling thread when a worker could not be spawned */
+      run->worker(&workers[i]);
+    }
+  }
+  return NULL;
+}
+
+static void
+batch_run(struct batch_t* batch, void* (*worker)(void*))
+{
+  struct batch_run_t run = { batch, worker };
+#ifdef HAVE_RUBY_THREAD_H
+  rb_thread_call_without_gvl(batch_run_without_gvl, &run, NULL, NULL);
+#else
+  batch_run_without_gvl(&run);
+#endif
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+struct compress_batch_args {
+  struct batch_t* batch;
+  VALUE inputs;
+  struct compress_options options;
+};
+
+static VALUE
+compress_batch_body(VALUE arg)
+{
+  struct compress_batch_args* args = (struct compress_batch_args*)arg;
+  struct batch_t* batch = args->batch;
+  VALUE outputs = rb_ary_new_capa(batch->count);
+  long i;
+  int w;
+
+  batch_alloc(batch);
+  for (i = 0; i < batch->count; i++) {
+    size_t const max_compressed_size = ZSTD_compressBound(RSTRING_LEN(RARRAY_AREF(args->inputs, i)));
+    rb_ary_push(outputs, rb_str_new(NULL, max_compressed_size));
+  }
+
+  batch->ctxs = ZALLOC_N(ZSTD_CCtx*, batch->n_workers);
+  for (w = 0; w < batch->n_workers; w++) {
+    ZSTD_CCtx* const ctx = zstd_ruby_create_cctx();
+    if (ctx == NULL) {
+      rb_raise(rb_eRuntimeError, "%s", "ZSTD_createCCtx error");
+    }
+    set_compress_options(ctx, &args->options);
+    batch->ctxs[w] = ctx;
+  }
+
+  batch_set_buffers(batch, args->inputs, outputs);
+  batch_run(batch, batch_compress_worker);
+
+  for (i = 0; i < batch->count; i++) {
+    if (ZSTD_isError(batch->ret[i])) {
+      rb_raise(rb_eRuntimeError, "compress error error code: %s (index %ld)", ZSTD_getErrorName(batch->ret[i]), i);
+    }
+    rb_str_resize(RARRAY_AREF(outputs, i), batch->ret[i]);
+  }
+  RB_GC_GUARD(args->inputs);
+  return outputs;
+}
+#endif
+
+static VALUE
+batch_inputs(VALUE input_values)
+{
+  Check_Type(input_values, T_ARRAY);
+  long count = RARRAY_LEN(input_values);
+  VALUE inputs = rb_ary_new_capa(count);
+  long i;
+  for (i = 0; i < count; i++) {
+    VALUE input = RARRAY_AREF(input_values, i);
+    StringValue(input);
+    rb_ary_push(inputs, input);
+  }
+  return inputs;
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+static VALUE
+rb_compress_batch(int argc, VALUE *argv, VALUE self)
+{
+  VALUE input_values;
+  VALUE kwargs;
+  rb_scan_args(argc, argv, "10:", &input_values, &kwargs);
+
+  ID kwargs_keys[4];
+  kwargs_keys[0] = rb_intern("level");
+  kwargs_keys[1] = rb_intern("dict");
+  kwargs_keys[2] = rb_intern("checksum");
+  kwargs_keys[3] = rb_intern("threads");
+  VALUE kwargs_values[4];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 4, kwargs_values);
+
+  VALUE inputs = batch_inputs(input_values);
+  long count = RARRAY_LEN(inputs);
+  int n_workers = batch_threads(kwargs_values[3], count);
+  batch_check_level(kwargs_values[0]);
+
+  struct batch_t batch = { 0 };
+  batch.count = count;
+  batch.n_workers = n_workers;
+  struct compress_batch_args args = { &batch, inputs, { kwargs_values[0], kwargs_values[1], kwargs_values[2] } };
+  return rb_ensure(compress_batch_body, (VALUE)&args, batch_free, (VALUE)&batch);
+}
+#endif
+
+struct decompress_batch_args {
+  struct batch_t* batch;
+  VALUE inputs;
+  struct decompress_options options;
+};
+
+static VALUE
+decompress_batch_body(VALUE arg)
+{
+  struct decompress_batch_args* args = (struct decompress_batch_args*)arg;
+  struct batch_t* batch = args->batch;
+  VALUE outputs = rb_ary_new_capa(batch->count);
+  long i;
+  int w;
+
+  batch_alloc(batch);
+  batch->heap_dst = ZALLOC_N(char*, batch->count);
+  for (i = 0; i < batch->count; i++) {
+    VALUE input = RARRAY_AREF(args->inputs, i);
+    unsigned long long const content_size = zstd_ruby_trusted_content_size(RSTRING_PTR(input), RSTRING_LEN(input));
+    if (content_size == ZSTD_CONTENTSIZE_ERROR) {
+      rb_raise(rb_eRuntimeError, "not a zstd frame (index %ld)", i);
+    }
+    /* frames without a plausible content size are decoded into growable heap buffers by the workers */
+    rb_ary_push(outputs, content_size == ZSTD_CONTENTSIZE_UNKNOWN ? Qnil : rb_str_new(NULL, content_size));
+  }
+
+  batch->dctxs = ZALLOC_N(ZSTD_DCtx*, batch->n_workers);
+  for (w = 0; w < batch->n_workers; w++) {
+    ZSTD_DCtx* const dctx = zstd_ruby_create_dctx();
+    if (dctx == NULL) {
+      rb_raise(rb_eRuntimeError, "%s", "ZSTD_createDCtx error");
+    }
+    set_decompress_options(dctx, &args->options);
+    batch->dctxs[w] = dctx;
+  }
+
+  batch_set_buffers(batch, args->inputs, outputs);
+  batch_run(batch, batch_decompress_worker);
+
+  for (i = 0; i < batch->count; i++) {
+    if (ZSTD_isError(batch->ret[i])) {
+      rb_raise(rb_eRuntimeError, "decompress error error code: %s (index %ld)", ZSTD_getErrorName(batch->ret[i]), i);
+    }
+    if (batch->dst[i] == NULL) {
+      rb_ary_store(outputs, i, rb_str_new(batch->heap_dst[i], batch->dst_size[i]));
+    } else {
+      rb_str_resize(RARRAY_AREF(outputs, i), batch->ret[i]);
+    }
+  }
+  RB_GC_GUARD(args->inputs);
+  return outputs;
+}
+
+static VALUE
+rb_decompress_batch(int argc, VALUE *argv, VALUE self)
+{
+  VALUE input_values;
+  VALUE kwargs;
+  rb_scan_args(argc, argv, "10:", &input_values, &kwargs);
+
+  ID kwargs_keys[3];
+  kwargs_keys[0] = rb_intern("dict");
+  kwargs_keys[1] = rb_intern("verify_checksum");
+  kwargs_keys[2] = rb_intern("threads");
+  VALUE kwargs_values[3];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 3, kwargs_values);
+
+  VALUE inputs = batch_inputs(input_values);
+  long count = RARRAY_LEN(inputs);
+  int n_workers = batch_threads(kwargs_values[2], count);
+
+  struct batch_t batch = { 0 };
+  batch.count = count;
+  batch.n_workers = n_workers;
+  struct decompress_batch_args args = { &batch, inputs, { kwargs_values[0], kwargs_values[1] } };
+  return rb_ensure(decompress_batch_body, (VALUE)&args, batch_free, (VALUE)&batch);
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+#define SEEKABLE_MAGIC_NUMBER 0x8F92EAB1U
+#define SEEKABLE_SKIPPABLE_MAGIC_VARIANT 0xE
+#define SEEKABLE_FOOTER_SIZE 9
+#define SEEKABLE_MAX_FRAME_SIZE (1U << 30)
+
+static void
+write_le32(char* dst, uint32_t value)
+{
+  unsigned char* p = (unsigned char*)dst;
+  p[0] = (unsigned char)value;
+  p[1] = (unsigned char)(value >> 8);
+  p[2] = (unsigned char)(value >> 16);
+  p[3] = (unsigned char)(value >> 24);
+}
+
+/* Seek table of the zstd seekable format, stored in a trailing skippable frame (no checksums) */
+static size_t
+write_seek_table(char* dst, const struct batch_t* batch)
+{
+  size_t const table_size = (size_t)batch->count * 8 + SEEKABLE_FOOTER_SIZE;
+  char* p = dst;
+  long i;
+  write_le32(p, ZSTD_MAGIC_SKIPPABLE_START | SEEKABLE_SKIPPABLE_MAGIC_VARIANT);
+  write_le32(p + 4, (uint32_t)table_size);
+  p += ZSTD_SKIPPABLEHEADERSIZE;
+  for (i = 0; i < batch->count; i++) {
+    write_le32(p, (uint32_t)batch->ret[i]);
+    write_le32(p + 4, (uint32_t)batch->src_size[i]);
+    p += 8;
+  }
+  write_le32(p, (uint32_t)batch->count);
+  p[4] = 0;
+  write_le32(p + 5, SEEKABLE_MAGIC_NUMBER);
+  return ZSTD_SKIPPABLEHEADERSIZE + table_size;
+}
+
+struct compress_frames_args {
+  struct batch_t* batch;
+  VALUE input;
+  const struct compress_options* options;
+  size_t frame_size;
+  bool seek_table;
+  VALUE metadata;
+  unsigned magic_variant;
+};
+
+static VALUE
+compress_frames_body(VALUE arg)
+{
+  struct compress_frames_args* args = (struct compress_frames_args*)arg;
+  struct batch_t* batch = args->batch;
+  size_t const input_size = RSTRING_LEN(args->input);
+  size_t const skippable_size = NIL_P(args->metadata) ? 0 : ZSTD_SKIPPABLEHEADERSIZE + RSTRING_LEN(args->metadata);
+  size_t output_size = skippable_size;
+  long i;
+  int w;
+
+  batch_alloc(batch);
+  for (i = 0; i < batch->count; i++) {
+    size_t const offset = (size_t)i * args->frame_size;
+    batch->src_size[i] = input_size - offset < args->frame_size ? input_size - offset : args->frame_size;
+    batch->dst_size[i] = ZSTD_compressBound(batch->src_size[i]);
+    output_size += batch->dst_size[i];
+  }
+  if (args->seek_table) {
+    output_size += ZSTD_SKIPPABLEHEADERSIZE + (size_t)batch->count * 8 + SEEKABLE_FOOTER_SIZE;
+  }
+  VALUE output = rb_str_new(NULL, output_size);
+
+  batch->ctxs = ZALLOC_N(ZSTD_CCtx*, batch->n_workers);
+  for (w = 0; w < batch->n_workers; w++) {
+    ZSTD_CCtx* const ctx = zstd_ruby_create_cctx();
+    if (ctx == NULL) {
+      rb_raise(rb_eRuntimeError, "%s", "ZSTD_createCCtx error");
+    }
+    set_compress_options(ctx, args->options);
+    batch->ctxs[w] = ctx;
+  }
+
+  /* every frame gets its own compressBound-sized slot, compacted in order afterwards */
+  const char* input_data = RSTRING_PTR(args->input);
+  char* output_data = RSTRING_PTR(output);
+  size_t slot = skippable_size;
+  for (i = 0; i < batch->count; i++) {
+    batch->src[i] = input_data + (size_t)i * args->frame_size;
+    batch->dst[i] = output_data + slot;
+    slot += batch->dst_size[i];
+  }
+
+  if (!NIL_P(args->metadata)) {
+    size_t const skippable_ret = ZSTD_writeSkippableFrame(output_data, skippable_size, RSTRING_PTR(args->metadata), RSTRING_LEN(args->metadata), args->magic_variant);
+    if (ZSTD_isError(skippable_ret)) {
+      rb_raise(rb_eRuntimeError, "%s: %s", "write skippable frame failed", ZSTD_getErrorName(skippable_ret));
+    }
+  }
+
+  batch_run(batch, batch_compress_worker);
+
+  size_t pos = skippable_size;
+  for (i = 0; i < batch->count; i++) {
+    if (ZSTD_isError(batch->ret[i])) {
+      rb_raise(rb_eRuntimeError, "compress error error code: %s", ZSTD_getErrorName(batch->ret[i]));
+    }
+    memmove(output_data + pos, batch->dst[i], batch->ret[i]);
+    pos += batch->ret[i];
+  }
+  if (args->seek_table) {
+    pos += write_seek_table(output_data + pos, batch);
+  }
+  rb_str_resize(output, pos);
+  RB_GC_GUARD(args->input);
+  return output;
+}
+
+VALUE
+zstd_compress_frames(VALUE input_value, const struct compress_options* options, int threads, size_t frame_size, bool seek_table, VALUE metadata, unsigned magic_variant)
+{
+  size_t const input_size = RSTRING_LEN(input_value);
+  if (frame_size == 0) {
+    rb_raise(rb_eArgError, "`frame_size:` must be a positive Integer");
+  }
+  if (seek_table && frame_size > SEEKABLE_MAX_FRAME_SIZE) {
+    rb_raise(rb_eArgError, "`frame_size:` must be at most %u bytes with `seek_table:`", SEEKABLE_MAX_FRAME_SIZE);
+  }
+  batch_check_level(options->level);
+  long count = input_size == 0 ? 1 : (long)((input_size - 1) / frame_size + 1);
+
+  struct batch_t batch = { 0 };
+  batch.count = count;
+  batch.n_workers = threads > count ? (int)count : threads;
+  struct compress_frames_args args = { &batch, input_value, options, frame_size, seek_table, metadata, magic_variant };
+  return rb_ensure(compress_frames_body, (VALUE)&args, batch_free, (VALUE)&batch);
+}
+#endif
+
+struct decompress_frames_args {
+  struct batch_t* batch;
+  VALUE input;
+  const struct decompress_options* options;
+  size_t output_size;
+};
+
+static VALUE
+decompress_frames_body(VALUE arg)
+{
+  struct decompress_frames_args* args = (struct decompress_frames_args*)arg;
+  struct batch_t* batch = args->batch;
+  long i;
+  int w;
+
+  batch_alloc(batch);
+  VALUE output = rb_str_new(NULL, args->output_size);
+
+  batch->dctxs = ZALLOC_N(ZSTD_DCtx*, batch->n_workers);
+  for (w = 0; w < batch->n_workers; w++) {
+    ZSTD_DCtx* const dctx = zstd_ruby_create_dctx();
+    if (dctx == NULL) {
+      rb_raise(rb_eRuntimeError, "%s", "ZSTD_createDCtx error");
+    }
+    set_decompress_options(dctx, args->options);
+    batch->dctxs[w] = dctx;
+  }
+
+  /* every frame is decoded straight into its own slice of the output */
+  const char* input_data = RSTRING_PTR(args->input);
+  size_t const input_size = RSTRING_LEN(args->input);
+  char* output_data = RSTRING_PTR(output);
+  size_t offset = 0;
+  size_t output_offset = 0;
+  for (i = 0; i < batch->count; i++) {
+    size_t const frame_size = ZSTD_findFrameCompressedSize(input_data + offset, input_size - offset);
+    batch->src[i] = input_data + offset;
+    batch->src_size[i] = frame_size;
+    batch->dst[i] = output_data + output_offset;
+    batch->dst_size[i] = (size_t)ZSTD_getFrameContentSize(input_data + offset, frame_size);
+    offset += frame_size;
+    output_offset += batch->dst_size[i];
+  }
+
+  batch_run(batch, batch_decompress_worker);
+
+  for (i = 0; i < batch->count; i++) {
+    if (ZSTD_isError(batch->ret[i])) {
+      rb_raise(rb_eRuntimeError, "decompress error error code: %s", ZSTD_getErrorName(batch->ret[i]));
+    }
+    if (batch->ret[i] != batch->dst_size[i]) {
+      rb_raise(rb_eRuntimeError, "decompress error: frame content size mismatch");
+    }
+  }
+  RB_GC_GUARD(args->input);
+  return output;
+}
+
+/*
+ * Returns nil when the frames cannot be laid out upfront (unknown or implausible content size, garbage),
+ * so the caller falls back to serial decoding
+ */
+VALUE
+zstd_decompress_frames(VALUE input_value, const struct decompress_options* options, int threads)
+{
+  const char* input_data = RSTRING_PTR(input_value);
+  size_t const input_size = RSTRING_LEN(input_value);
+  size_t offset = 0;
+  size_t output_size = 0;
+  long count = 0;
+
+  while (offset < input_size) {
+    size_t const frame_size = ZSTD_findFrameCompressedSize(input_data + offset, input_size - offset);
+    if (ZSTD_isError(frame_size)) {
+      return Qnil;
+    }
+    unsigned long long const content_size = zstd_ruby_trusted_content_size(input_data + offset, frame_size);
+    if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size == ZSTD_CONTENTSIZE_ERROR ||
+        content_size > SIZE_MAX - output_size) {
+      return Qnil;
+    }
+    output_size += content_size;
+    offset += frame_size;
+    count++;
+  }
+  if (count == 0) {
+    return Qnil;
+  }
+
+  struct batch_t batch = { 0 };
+  batch.count = count;
+  batch.n_workers = threads > count ? (int)count : threads;
+  struct decompress_frames_args args = { &batch, input_value, options, output_size };
+  return rb_ensure(decompress_frames_body, (VALUE)&args, batch_free, (VALUE)&batch);
+}
+
+void
+zstd_ruby_batch_init(void)
+{
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  rb_define_module_function(rb_mZstd, "compress_batch", rb_compress_batch, -1);
+#endif
+  rb_define_module_function(rb_mZstd, "decompress_batch", rb_decompress_batch, -1);
+}
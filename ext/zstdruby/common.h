@@ -6,10 +6,40 @@
 #ifdef HAVE_RUBY_THREAD_H
 #include <ruby/thread.h>
 #endif
+#ifdef USE_SYSTEM_ZSTD
+#include <zstd.h>
+#else
 #include "./libzstd/zstd.h"
+#endif
 
 extern VALUE rb_cCDict, rb_cDDict;
 
+/* defined in memory.c; contexts use a counting allocator while Zstd.malloc_stats_enabled is set */
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+ZSTD_CCtx* zstd_ruby_create_cctx(void);
+#endif
+ZSTD_DCtx* zstd_ruby_create_dctx(void);
+ZSTD_DDict* zstd_ruby_create_ddict(const void* dict, size_t dict_size);
+
+/* defined in memory.c; per-Ractor contexts of the one-shot APIs, released contexts are reset on the next acquire */
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+ZSTD_CCtx* zstd_ruby_acquire_cctx(void);
+void zstd_ruby_release_cctx(ZSTD_CCtx* ctx);
+#endif
+ZSTD_DCtx* zstd_ruby_acquire_dctx(void);
+void zstd_ruby_release_dctx(ZSTD_DCtx* dctx);
+
+/* defined in frame_info.c; the content size of src when its frame headers can be trusted to size an output buffer */
+unsigned long long zstd_ruby_trusted_content_size(const char* src, size_t src_size);
+
+/* defined in mapped.c; File and IO::Buffer inputs are passed to `func` as Strings viewing their bytes in place */
+typedef VALUE (*zstd_ruby_input_func)(int argc, VALUE* argv, VALUE self);
+bool zstd_ruby_mappable_p(VALUE input);
+VALUE zstd_ruby_with_mapped_inputs(int argc, const VALUE* argv, VALUE self, zstd_ruby_input_func func);
+VALUE zstd_ruby_decompress_to_file(ZSTD_DCtx* dctx, const char* src, size_t src_size, VALUE file);
+
+/* `--enable-decompress-only` builds leave out libzstd/compress */
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
 static int convert_compression_level(ZSTD_CCtx* ctx, VALUE compression_level_value)
 {
   if (NIL_P(compression_level_value)) {
@@ -24,31 +54,25 @@ static int convert_compression_level(ZSTD_CCtx* ctx, VALUE compression_level_val
   return NUM2INT(compression_level_value);
 }
 
-static void set_compress_params(ZSTD_CCtx* const ctx, VALUE kwargs)
+static void set_compress_level_and_dict(ZSTD_CCtx* const ctx, VALUE level_value, VALUE dict_value)
 {
-  ID kwargs_keys[2];
-  kwargs_keys[0] = rb_intern("level");
-  kwargs_keys[1] = rb_intern("dict");
-  VALUE kwargs_values[2];
-  rb_get_kwargs(kwargs, kwargs_keys, 0, 2, kwargs_values);
-
   int compression_level = ZSTD_CLEVEL_DEFAULT;
-  if (kwargs_values[0] != Qundef && kwargs_values[0] != Qnil) {
-    compression_level = convert_compression_level(ctx, kwargs_values[0]);
+  if (level_value != Qundef && level_value != Qnil) {
+    compression_level = convert_compression_level(ctx, level_value);
   }
   ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, compression_level);
 
-  if (kwargs_values[1] != Qundef && kwargs_values[1] != Qnil) {
-    if (CLASS_OF(kwargs_values[1]) == rb_cCDict) {
-      ZSTD_CDict* cdict = DATA_PTR(kwargs_values[1]);
+  if (dict_value != Qundef && dict_value != Qnil) {
+    if (CLASS_OF(dict_value) == rb_cCDict) {
+      ZSTD_CDict* cdict = DATA_PTR(dict_value);
       size_t ref_dict_ret = ZSTD_CCtx_refCDict(ctx, cdict);
       if (ZSTD_isError(ref_dict_ret)) {
         ZSTD_freeCCtx(ctx);
         rb_raise(rb_eRuntimeError, "%s", "ZSTD_CCtx_refCDict failed");
       }
-    } else if (TYPE(kwargs_values[1]) == T_STRING) {
-      char* dict_buffer = RSTRING_PTR(kwargs_values[1]);
-      size_t dict_size = RSTRING_LEN(kwargs_values[1]);
+    } else if (TYPE(dict_value) == T_STRING) {
+      char* dict_buffer = RSTRING_PTR(dict_value);
+      size_t dict_size = RSTRING_LEN(dict_value);
       size_t load_dict_ret = ZSTD_CCtx_loadDictionary(ctx, dict_buffer, dict_size);
       if (ZSTD_isError(load_dict_ret)) {
         ZSTD_freeCCtx(ctx);
@@ -61,6 +85,60 @@ static void set_compress_params(ZSTD_CCtx* const ctx, VALUE kwargs)
   }
 }
 
+struct compress_options {
+  VALUE level;
+  VALUE dict;
+  VALUE checksum;
+};
+
+static void set_compress_options(ZSTD_CCtx* const ctx, const struct compress_options* options)
+{
+  set_compress_level_and_dict(ctx, options->level, options->dict);
+  if (options->checksum != Qundef && options->checksum != Qnil) {
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_checksumFlag, RTEST(options->checksum) ? 1 : 0);
+  }
+}
+
+static void set_target_block_size(ZSTD_CCtx* const ctx, VALUE latency_value, VALUE target_block_size_value)
+{
+  int target_block_size = 0;
+  if (latency_value != Qundef && latency_value != Qnil) {
+    if (latency_value == ID2SYM(rb_intern("low"))) {
+      target_block_size = ZSTD_TARGETCBLOCKSIZE_MIN;
+    } else if (latency_value != ID2SYM(rb_intern("normal"))) {
+      ZSTD_freeCCtx(ctx);
+      rb_raise(rb_eArgError, "`latency:` must be :low or :normal");
+    }
+  }
+  if (target_block_size_value != Qundef && target_block_size_value != Qnil) {
+    target_block_size = NUM2INT(target_block_size_value);
+  }
+  if (target_block_size == 0) {
+    return;
+  }
+  if (target_block_size < ZSTD_TARGETCBLOCKSIZE_MIN || target_block_size > ZSTD_TARGETCBLOCKSIZE_MAX ||
+      ZSTD_isError(ZSTD_CCtx_setParameter(ctx, ZSTD_c_targetCBlockSize, target_block_size))) {
+    ZSTD_freeCCtx(ctx);
+    rb_raise(rb_eArgError, "`target_block_size:` must be between %d and %d", ZSTD_TARGETCBLOCKSIZE_MIN, ZSTD_TARGETCBLOCKSIZE_MAX);
+  }
+}
+
+static void set_compress_params(ZSTD_CCtx* const ctx, VALUE kwargs)
+{
+  ID kwargs_keys[5];
+  kwargs_keys[0] = rb_intern("level");
+  kwargs_keys[1] = rb_intern("dict");
+  kwargs_keys[2] = rb_intern("checksum");
+  kwargs_keys[3] = rb_intern("latency");
+  kwargs_keys[4] = rb_intern("target_block_size");
+  VALUE kwargs_values[5];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 5, kwargs_values);
+
+  struct compress_options options = { kwargs_values[0], kwargs_values[1], kwargs_values[2] };
+  set_compress_options(ctx, &options);
+  set_target_block_size(ctx, kwargs_values[3], kwargs_values[4]);
+}
+
 struct stream_compress_params {
   ZSTD_CCtx* ctx;
   ZSTD_outBuffer* output;
@@ -121,25 +199,21 @@ static size_t zstd_compress(ZSTD_CCtx* const ctx, char* output_data, size_t outp
     return ZSTD_compress2(ctx , output_data, output_size, input_data, input_size);
 #endif
 }
+#endif /* ZSTD_RUBY_DECOMPRESS_ONLY */
 
-static void set_decompress_params(ZSTD_DCtx* const dctx, VALUE kwargs)
+static void set_decompress_dict(ZSTD_DCtx* const dctx, VALUE dict_value)
 {
-  ID kwargs_keys[1];
-  kwargs_keys[0] = rb_intern("dict");
-  VALUE kwargs_values[1];
-  rb_get_kwargs(kwargs, kwargs_keys, 0, 1, kwargs_values);
-
-  if (kwargs_values[0] != Qundef && kwargs_values[0] != Qnil) {
-    if (CLASS_OF(kwargs_values[0]) == rb_cDDict) {
-      ZSTD_DDict* ddict = DATA_PTR(kwargs_values[0]);
+  if (dict_value != Qundef && dict_value != Qnil) {
+    if (CLASS_OF(dict_value) == rb_cDDict) {
+      ZSTD_DDict* ddict = DATA_PTR(dict_value);
       size_t ref_dict_ret = ZSTD_DCtx_refDDict(dctx, ddict);
       if (ZSTD_isError(ref_dict_ret)) {
         ZSTD_freeDCtx(dctx);
         rb_raise(rb_eRuntimeError, "%s", "ZSTD_DCtx_refDDict failed");
       }
-    } else if (TYPE(kwargs_values[0]) == T_STRING) {
-      char* dict_buffer = RSTRING_PTR(kwargs_values[0]);
-      size_t dict_size = RSTRING_LEN(kwargs_values[0]);
+    } else if (TYPE(dict_value) == T_STRING) {
+      char* dict_buffer = RSTRING_PTR(dict_value);
+      size_t dict_size = RSTRING_LEN(dict_value);
       size_t load_dict_ret = ZSTD_DCtx_loadDictionary(dctx, dict_buffer, dict_size);
       if (ZSTD_isError(load_dict_ret)) {
         ZSTD_freeDCtx(dctx);
@@ -152,6 +226,31 @@ static void set_decompress_params(ZSTD_DCtx* const dctx, VALUE kwargs)
   }
 }
 
+struct decompress_options {
+  VALUE dict;
+  VALUE verify_checksum;
+};
+
+static void set_decompress_options(ZSTD_DCtx* const dctx, const struct decompress_options* options)
+{
+  set_decompress_dict(dctx, options->dict);
+  if (options->verify_checksum != Qundef && options->verify_checksum != Qnil) {
+    ZSTD_DCtx_setParameter(dctx, ZSTD_d_forceIgnoreChecksum, RTEST(options->verify_checksum) ? ZSTD_d_validateChecksum : ZSTD_d_ignoreChecksum);
+  }
+}
+
+static void set_decompress_params(ZSTD_DCtx* const dctx, VALUE kwargs)
+{
+  ID kwargs_keys[2];
+  kwargs_keys[0] = rb_intern("dict");
+  kwargs_keys[1] = rb_intern("verify_checksum");
+  VALUE kwargs_values[2];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 2, kwargs_values);
+
+  struct decompress_options options = { kwargs_values[0], kwargs_values[1] };
+  set_decompress_options(dctx, &options);
+}
+
 struct stream_decompress_params {
   ZSTD_DCtx* dctx;
   ZSTD_outBuffer* output;
@@ -1,6 +1,14 @@
 require "mkmf"
+require "fileutils"
 
 have_func('rb_gc_mark_movable')
+have_func('rb_ractor_local_storage_ptr_newkey', 'ruby/ractor.h')
+have_func('posix_fadvise', 'fcntl.h')
+have_func('fchmod', 'sys/stat.h')
+have_func('fchown', 'unistd.h')
+have_header('sys/mman.h') && have_func('mmap', 'sys/mman.h') && have_func('madvise', 'sys/mman.h')
+have_func('rb_io_descriptor', 'ruby/io.h')
+have_header('ruby/io/buffer.h') && have_func('rb_io_buffer_get_bytes_for_reading', 'ruby/io/buffer.h')
 
 # Check if ruby_abi_version symbol is required
 # Based on grpc's approach: https://github.com/grpc/grpc/blob/master/src/ruby/ext/grpc/extconf.rb
@@ -26,7 +34,43 @@ def ext_export_filename
   name
 end
 
-$CFLAGS = '-I. -O3 -std=c99 -DZSTD_STATIC_LINKING_ONLY -DZSTD_MULTITHREAD -pthread -DDEBUGLEVEL=0 -fvisibility=hidden -DZSTDLIB_VISIBLE=\'__attribute__((visibility("hidden")))\' -DZSTDLIB_HIDDEN=\'__attribute__((visibility("hidden")))\''
+# Bundled libzstd by default. `--with-system-zstd` (or `--with-zstd-dir=DIR`, `--with-zstd-include=DIR`, `--with-zstd-lib=DIR`)
+# links a system libzstd instead, falling back to the bundled copy when it is missing or older than the bundled version.
+# gem install zstd-ruby -- --with-system-zstd
+# gem install zstd-ruby -- --with-zstd-dir=/opt/zstd
+BUNDLED_ZSTD_VERSION_NUMBER = 10507 # ext/zstdruby/libzstd/zstd.h
+
+zstd_dir = dir_config('zstd')
+use_system_zstd = with_config('system-zstd', false) || !zstd_dir.compact.empty?
+
+if use_system_zstd
+  libs = $libs.dup
+  use_system_zstd =
+    have_header('zstd.h') &&
+    have_library('zstd', 'ZSTD_versionNumber', 'zstd.h') &&
+    checking_for(checking_message('libzstd', nil, "version >= #{BUNDLED_ZSTD_VERSION_NUMBER}")) do
+      try_compile(<<~SRC)
+        #include <zstd.h>
+        #if ZSTD_VERSION_NUMBER < #{BUNDLED_ZSTD_VERSION_NUMBER}
+        #error libzstd is too old
+        #endif
+      SRC
+    end
+  unless use_system_zstd
+    warn 'zstd-ruby: usable system libzstd not found, falling back to the bundled libzstd'
+    $libs = libs
+  end
+  # find a libzstd outside the default search path at runtime
+  $LDFLAGS << " -Wl,-rpath,#{zstd_dir[1]}" if use_system_zstd && zstd_dir[1] && RUBY_PLATFORM !~ /mswin|mingw/
+end
+
+if use_system_zstd
+  # the trace hooks are only called by the bundled libzstd, and declarations must stay visible to link against the shared library
+  $CFLAGS = '-I. -O3 -std=c99 -DZSTD_STATIC_LINKING_ONLY -DZSTD_MULTITHREAD -DZSTD_TRACE=0 -pthread -DDEBUGLEVEL=0 -fvisibility=hidden'
+  $defs << '-DUSE_SYSTEM_ZSTD'
+else
+  $CFLAGS = '-I. -O3 -std=c99 -DZSTD_STATIC_LINKING_ONLY -DZSTD_MULTITHREAD -DZSTD_TRACE=1 -pthread -DDEBUGLEVEL=0 -fvisibility=hidden -DZSTDLIB_VISIBLE=\'__attribute__((visibility("hidden")))\' -DZSTDLIB_HIDDEN=\'__attribute__((visibility("hidden")))\''
+end
 $CPPFLAGS += " -fdeclspec" if CONFIG['CXX'] =~ /clang/
 
 # macOS specific: Use exported_symbols_list to control symbol visibility
@@ -36,8 +80,54 @@ if RUBY_PLATFORM =~ /darwin/
   puts "Using export file: #{ext_export_file}"
 end
 
+# Trimmed variants of the bundled libzstd for short-lived processes, mirroring the options of zstd's lib/Makefile.
+# gem install zstd-ruby -- --enable-minify
+# gem install zstd-ruby -- --with-huf-decoder=x1 --exclude-block-compressors=btlazy2,btopt,btultra --disable-dict-builder
+# gem install zstd-ruby -- --enable-decompress-only
+BLOCK_COMPRESSORS = %w[dfast greedy lazy lazy2 btlazy2 btopt btultra]
+
+minify = enable_config('minify', false)
+decompress_only = enable_config('decompress-only', false)
+dict_builder = enable_config('dict-builder', true) && !minify && !decompress_only
+huf_decoder = with_config('huf-decoder', minify ? 'x1' : nil)
+excluded_block_compressors = arg_config('--exclude-block-compressors', '').to_s.split(',').map(&:strip)
+
+if use_system_zstd
+  if minify || decompress_only || !dict_builder || huf_decoder || !excluded_block_compressors.empty?
+    warn 'zstd-ruby: trimmed build options only apply to the bundled libzstd, ignoring them'
+  end
+  decompress_only = false
+else
+  if minify
+    # ZSTD_LIB_MINIFY=1: smaller code at the cost of speed, and error names are replaced by a generic string
+    $CFLAGS = $CFLAGS.sub('-O3', try_cflags('-Oz') ? '-Oz' : '-Os')
+    $CFLAGS << ' -DZSTD_FORCE_DECOMPRESS_SEQUENCES_SHORT -DZSTD_NO_INLINE -DZSTD_STRIP_ERROR_STRINGS -DDYNAMIC_BMI2=0'
+    $CFLAGS << ' -fno-stack-protector -fomit-frame-pointer -fno-ident'
+  end
+  case huf_decoder
+  when nil
+  when 'x1' then $CFLAGS << ' -DHUF_FORCE_DECOMPRESS_X1'
+  when 'x2' then $CFLAGS << ' -DHUF_FORCE_DECOMPRESS_X2'
+  else abort "zstd-ruby: --with-huf-decoder must be x1 or x2, got #{huf_decoder}"
+  end
+  unknown = excluded_block_compressors - BLOCK_COMPRESSORS
+  abort "zstd-ruby: unknown block compressors #{unknown.join(', ')}, expected #{BLOCK_COMPRESSORS.join(', ')}" unless unknown.empty?
+  excluded_block_compressors.each { |name| $CFLAGS << " -DZSTD_EXCLUDE_#{name.upcase}_BLOCK_COMPRESSOR" }
+  # the Ruby sources need the same guards as libzstd
+  $defs << '-DZSTD_RUBY_NO_DICT_BUILDER' unless dict_builder
+  $defs << '-DZSTD_RUBY_DECOMPRESS_ONLY' if decompress_only
+end
+
 Dir.chdir File.expand_path('..', __FILE__) do
-  $srcs = Dir['**/*.c', '**/*.S']
+  if use_system_zstd
+    # only the threading wrappers, the thread pool and XXH64 are taken from the bundled sources
+    $srcs = Dir['*.c'] + ['libzstd/common/threading.c', 'libzstd/common/pool.c', 'libzstd/common/xxhash.c']
+    $VPATH << "$(srcdir)/libzstd/common"
+    $INCFLAGS << " -I$(srcdir)/libzstd/common"
+  else
+    $srcs = Dir['**/*.c', '**/*.S']
+    $srcs.reject! { |src| src.start_with?('libzstd/dictBuilder/') } unless dict_builder
+    $srcs.reject! { |src| src == 'streaming_compress.c' || src.start_with?('libzstd/compress/') } if decompress_only
 
     Dir.glob('libzstd/*') do |path|
         if Dir.exist?(path)
@@ -45,13 +135,77 @@ Dir.chdir File.expand_path('..', __FILE__) do
             $INCFLAGS << " -I$(srcdir)/#{path}"
         end
     end
-
+  end
 end
 
 # add include path to the internal folder
 # $(srcdir) is a root folder, where "extconf.rb" is stored
-$INCFLAGS << " -I$(srcdir) -I$(srcdir)/libzstd"
+$INCFLAGS << " -I$(srcdir)"
+$INCFLAGS << " -I$(srcdir)/libzstd" unless use_system_zstd
 # add folder, where compiler can search source files
 $VPATH << "$(srcdir)"
 
+# Opt-in build profiles for homogeneous fleets. The resulting binary may not run on other CPUs.
+# gem install zstd-ruby -- --enable-march-native --enable-lto --enable-pgo
+if enable_config('march-native', false)
+  if try_cflags('-march=native')
+    # also makes libzstd select BMI2 code paths at compile time instead of dispatching at runtime
+    $CFLAGS << ' -march=native'
+  else
+    warn 'zstd-ruby: the compiler does not support -march=native, ignoring --enable-march-native'
+  end
+end
+
+if enable_config('lto', false)
+  if try_cflags('-flto') && try_ldflags('-flto')
+    $CFLAGS << ' -flto'
+    $LDFLAGS << ' -flto'
+  else
+    warn 'zstd-ruby: the compiler does not support -flto, ignoring --enable-lto'
+  end
+end
+
+# Profile-guided optimization: build an instrumented extension in the build directory, run pgo_train.rb
+# with it, then generate the final Makefile with the collected profile.
+def pgo_flags
+  clang = CONFIG['CC'] =~ /clang/ || RUBY_PLATFORM =~ /darwin/
+  return [' -fprofile-generate -fprofile-update=atomic', ' -fprofile-use -fprofile-correction -Wno-missing-profile', nil] unless clang
+
+  profdata = find_executable('llvm-profdata') || (RUBY_PLATFORM =~ /darwin/ && `xcrun -f llvm-profdata 2>/dev/null`.strip)
+  return nil if !profdata || profdata.empty?
+  dir = File.expand_path('pgo-data')
+  merge = -> { system(profdata, 'merge', "-output=#{dir}/zstdruby.profdata", *Dir["#{dir}/*.profraw"]) }
+  [" -fprofile-generate=#{dir}", " -fprofile-use=#{dir}/zstdruby.profdata -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date", merge]
+end
+
+def pgo_train(generate_flags)
+  cflags, ldflags = $CFLAGS.dup, $LDFLAGS.dup
+  $CFLAGS << generate_flags
+  $LDFLAGS << generate_flags
+  create_makefile("zstd-ruby/zstdruby")
+  make = ENV['MAKE'] || find_executable('gmake') || 'make'
+  trained = system(make) && begin
+    FileUtils.mkdir_p('pgo-train/zstd-ruby')
+    FileUtils.cp("zstdruby.#{CONFIG['DLEXT']}", 'pgo-train/zstd-ruby/')
+    system(RbConfig.ruby, '-Ipgo-train', File.join(__dir__, 'pgo_train.rb'))
+  end
+  system(make, 'clean')
+  FileUtils.rm_rf('pgo-train')
+  $CFLAGS, $LDFLAGS = cflags, ldflags
+  trained
+end
+
+if enable_config('pgo', false)
+  generate_flags, use_flags, merge = pgo_flags
+  if decompress_only
+    warn 'zstd-ruby: the PGO training workload needs compression, ignoring --enable-pgo'
+  elsif generate_flags.nil?
+    warn 'zstd-ruby: llvm-profdata not found, ignoring --enable-pgo'
+  elsif pgo_train(generate_flags) && (merge.nil? || merge.call)
+    $CFLAGS << use_flags
+  else
+    warn 'zstd-ruby: PGO training failed, building without a profile'
+  end
+end
+
 create_makefile("zstd-ruby/zstdruby")
@@ -0,0 +1,435 @@
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "ruby/io.h"
+
+extern VALUE rb_mZstd;
+
+/*
+ * Zstd.compress_file / Zstd.decompress_file stream one file into another with plain read(2) and
+ * write(2) on large buffers, without the GVL and without Ruby Strings. The loop leaves the
+ * no-GVL section for interrupts and for the progress callback, then resumes where it stopped.
+ */
+
+#define FILE_IN_SIZE (1 << 20)
+#define FILE_PROGRESS_INTERVAL (16 << 20) /* input bytes between progress callbacks */
+
+enum file_status { FILE_RUNNING, FILE_DONE, FILE_PAUSED, FILE_IO_ERROR, FILE_ZSTD_ERROR, FILE_TRUNCATED };
+
+struct file_job_t {
+  int src_fd;
+  int dst_fd;
+  VALUE src_path;
+  VALUE dst_path;
+  VALUE tmp_path;           /* written instead of dst_path, renamed to it once complete */
+  VALUE progress;
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  ZSTD_CCtx* cctx;
+#endif
+  ZSTD_DCtx* dctx;
+  char* in_buf;
+  char* out_buf;
+  size_t out_size;
+  ZSTD_inBuffer in;
+  bool eof;
+  bool out_full;            /* the decoder may hold more output for the current input */
+  size_t ret;               /* last libzstd return value */
+  int err;                  /* errno of an I/O error */
+  bool err_on_src;
+  volatile int interrupted;
+  unsigned long long bytes_read;
+  unsigned long long bytes_written;
+  unsigned long long next_progress;
+};
+
+static bool
+file_read(struct file_job_t* job)
+{
+  ssize_t n;
+  do {
+    n = read(job->src_fd, job->in_buf, FILE_IN_SIZE);
+  } while (n < 0 && errno == EINTR && !job->interrupted);
+  if (n < 0) {
+    job->err = errno;
+    job->err_on_src = true;
+    return false;
+  }
+  job->in.src = job->in_buf;
+  job->in.size = (size_t)n;
+  job->in.pos = 0;
+  job->eof = n == 0;
+  job->bytes_read += (unsigned long long)n;
+  return true;
+}
+
+static bool
+file_write(struct file_job_t* job, size_t size)
+{
+  size_t pos = 0;
+  while (pos < size) {
+    ssize_t const n = write(job->dst_fd, job->out_buf + pos, size - pos);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      job->err = errno;
+      job->err_on_src = false;
+      return false;
+    }
+    pos += (size_t)n;
+  }
+  job->bytes_written += size;
+  return true;
+}
+
+/* stops the loop between two buffers, so that the calling thread can take interrupts */
+static void
+file_ubf(void* arg)
+{
+  struct file_job_t* job = arg;
+  job->interrupted = 1;
+}
+
+static enum file_status
+file_pause_point(struct file_job_t* job)
+{
+  if (job->interrupted) {
+    return FILE_PAUSED;
+  }
+  if (!NIL_P(job->progress) && job->bytes_read >= job->next_progress) {
+    job->next_progress = job->bytes_read + FILE_PROGRESS_INTERVAL;
+    return FILE_PAUSED;
+  }
+  return FILE_RUNNING;
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+static void*
+compress_file_without_gvl(void* arg)
+{
+  struct file_job_t* job = arg;
+  for (;;) {
+    if (job->in.pos == job->in.size && !job->eof) {
+      enum file_status const status = file_pause_point(job);
+      if (status != FILE_RUNNING) {
+        return (void*)(VALUE)status;
+      }
+      if (!file_read(job)) {
+        return (void*)(VALUE)FILE_IO_ERROR;
+      }
+    }
+    ZSTD_EndDirective const mode = job->eof ? ZSTD_e_end : ZSTD_e_continue;
+    ZSTD_outBuffer out = { job->out_buf, job->out_size, 0 };
+    job->ret = ZSTD_compressStream2(job->cctx, &out, &job->in, mode);
+    if (ZSTD_isError(job->ret)) {
+      return (void*)(VALUE)FILE_ZSTD_ERROR;
+    }
+    if (!file_write(job, out.pos)) {
+      return (void*)(VALUE)FILE_IO_ERROR;
+    }
+    if (mode == ZSTD_e_end && job->ret == 0) {
+      return (void*)(VALUE)FILE_DONE;
+    }
+  }
+}
+#endif
+
+static void*
+decompress_file_without_gvl(void* arg)
+{
+  struct file_job_t* job = arg;
+  for (;;) {
+    if (job->in.pos == job->in.size && !job->out_full) {
+      if (job->eof) {
+        /* a non-zero hint at the end of the input means the last frame is incomplete */
+        return (void*)(VALUE)(job->ret == 0 ? FILE_DONE : FILE_TRUNCATED);
+      }
+      enum file_status const status = file_pause_point(job);
+      if (status != FILE_RUNNING) {
+        return (void*)(VALUE)status;
+      }
+      if (!file_read(job)) {
+        return (void*)(VALUE)FILE_IO_ERROR;
+      }
+      continue;
+    }
+    ZSTD_outBuffer out = { job->out_buf, job->out_size, 0 };
+    job->ret = ZSTD_decompressStream(job->dctx, &out, &job->in);
+    if (ZSTD_isError(job->ret)) {
+      return (void*)(VALUE)FILE_ZSTD_ERROR;
+    }
+    job->out_full = out.pos == out.size;
+    if (!file_write(job, out.pos)) {
+      return (void*)(VALUE)FILE_IO_ERROR;
+    }
+  }
+}
+
+static int
+file_open(VALUE path, int flags)
+{
+  int const fd = rb_cloexec_open(RSTRING_PTR(path), flags, 0666);
+  if (fd < 0) {
+    rb_syserr_fail_str(errno, path);
+  }
+  rb_update_max_fd(fd);
+  return fd;
+}
+
+/*
+ * The output goes to a new file next to dst, which replaces dst only once it is complete: a failed
+ * run leaves neither a partial file under the final name nor a truncated dst.
+ */
+static int
+file_open_tmp(struct file_job_t* job)
+{
+  for (int i = 0; ; i++) {
+    job->tmp_path = rb_sprintf("%"PRIsVALUE".%ld.%d.tmp", job->dst_path, (long)getpid(), i);
+    int const fd = rb_cloexec_open(RSTRING_PTR(job->tmp_path), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd >= 0) {
+      rb_update_max_fd(fd);
+      return fd;
+    }
+    int const err = errno;
+    if (err != EEXIST || i >= 100) {
+      job->tmp_path = Qnil;
+      rb_syserr_fail_str(err, job->dst_path);
+    }
+  }
+}
+
+struct file_run_args {
+  struct file_job_t* job;
+  void* (*loop)(void*);
+  const char* op;
+};
+
+static VALUE
+file_run(VALUE arg)
+{
+  struct file_run_args* args = (struct file_run_args*)arg;
+  struct file_job_t* job = args->job;
+
+#ifdef O_NONBLOCK
+  /* opening a FIFO would wait for a writer */
+  job->src_fd = file_open(job->src_path, O_RDONLY | O_NONBLOCK);
+#else
+  job->src_fd = file_open(job->src_path, O_RDONLY);
+#endif
+  struct stat src_st, dst_st;
+  bool dst_exists = false;
+  if (fstat(job->src_fd, &src_st) < 0) {
+    rb_syserr_fail_str(errno, job->src_path);
+  }
+  /* reads from pipes and devices may block forever, where the loop cannot be interrupted */
+  if (!S_ISREG(src_st.st_mode)) {
+    rb_raise(rb_eArgError, "%"PRIsVALUE" is not a regular file", job->src_path);
+  }
+  if (stat(RSTRING_PTR(job->dst_path), &dst_st) == 0) {
+    dst_exists = true;
+    if (dst_st.st_dev == src_st.st_dev && dst_st.st_ino == src_st.st_ino) {
+      rb_raise(rb_eArgError, "%s", "source and destination are the same file");
+    }
+    /* the temporary file would replace it */
+    if (!S_ISREG(dst_st.st_mode)) {
+      rb_raise(rb_eArgError, "%"PRIsVALUE" is not a regular file", job->dst_path);
+    }
+  }
+#ifdef O_NONBLOCK
+  fcntl(job->src_fd, F_SETFL, fcntl(job->src_fd, F_GETFL) & ~O_NONBLOCK);
+#endif
+  job->dst_fd = file_open_tmp(job);
+  if (dst_exists) {
+    /* the file that replaces dst keeps its owner where permitted, and its mode, e.g. 0600 */
+#ifdef HAVE_FCHOWN
+    if (fchown(job->dst_fd, dst_st.st_uid, dst_st.st_gid) < 0) {
+      /* only root may give the file away; the group may be one the caller is not in */
+    }
+#endif
+#ifdef HAVE_FCHMOD
+    if (fchmod(job->dst_fd, dst_st.st_mode & 07777) < 0) {
+      rb_syserr_fail_str(errno, job->dst_path);
+    }
+#endif
+  }
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(job->src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  if (job->cctx != NULL) {
+    /* the content size goes into the frame header, like the zstd command line tool does */
+    ZSTD_CCtx_setPledgedSrcSize(job->cctx, (unsigned long long)src_st.st_size);
+  }
+#endif
+  job->in_buf = malloc(FILE_IN_SIZE);
+  job->out_buf = malloc(job->out_size);
+  if (job->in_buf == NULL || job->out_buf == NULL) {
+    rb_raise(rb_eNoMemError, "%s", "failed to allocate file buffers");
+  }
+
+  for (;;) {
+    enum file_status status;
+    job->interrupted = 0;
+#ifdef HAVE_RUBY_THREAD_H
+    status = (enum file_status)(VALUE)rb_thread_call_without_gvl(args->loop, job, file_ubf, job);
+#else
+    status = (enum file_status)(VALUE)args->loop(job);
+#endif
+    switch (status) {
+    case FILE_DONE:
+      if (rename(RSTRING_PTR(job->tmp_path), RSTRING_PTR(job->dst_path)) < 0) {
+        rb_syserr_fail_str(errno, job->dst_path);
+      }
+      job->tmp_path = Qnil;
+      if (!NIL_P(job->progress)) {
+        rb_funcall(job->progress, rb_intern("call"), 2, ULL2NUM(job->bytes_read), ULL2NUM(job->bytes_written));
+      }
+      return ULL2NUM(job->bytes_written);
+    case FILE_PAUSED:
+      rb_thread_check_ints();
+      if (!NIL_P(job->progress) && !job->interrupted) {
+        rb_funcall(job->progress, rb_intern("call"), 2, ULL2NUM(job->bytes_read), ULL2NUM(job->bytes_written));
+      }
+      break;
+    case FILE_IO_ERROR:
+      rb_syserr_fail_str(job->err, job->err_on_src ? job->src_path : job->dst_path);
+    case FILE_ZSTD_ERROR:
+      rb_raise(rb_eRuntimeError, "%s error error code: %s", args->op, ZSTD_getErrorName(job->ret));
+    case FILE_TRUNCATED:
+      rb_raise(rb_eRuntimeError, "%s error error code: %s", args->op, "truncated frame");
+    default:
+      break;
+    }
+  }
+}
+
+static VALUE
+file_cleanup(VALUE arg)
+{
+  struct file_run_args* args = (struct file_run_args*)arg;
+  struct file_job_t* job = args->job;
+  if (job->src_fd >= 0) {
+    close(job->src_fd);
+  }
+  if (job->dst_fd >= 0) {
+    close(job->dst_fd);
+  }
+  if (!NIL_P(job->tmp_path)) {
+    unlink(RSTRING_PTR(job->tmp_path));
+  }
+  free(job->in_buf);
+  free(job->out_buf);
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  if (job->cctx != NULL) {
+    ZSTD_freeCCtx(job->cctx);
+  }
+#endif
+  if (job->dctx != NULL) {
+    ZSTD_freeDCtx(job->dctx);
+  }
+  return Qnil;
+}
+
+static void
+file_job_init(struct file_job_t* job, VALUE src_path, VALUE dst_path, VALUE progress)
+{
+  memset(job, 0, sizeof(*job));
+  job->src_fd = -1;
+  job->dst_fd = -1;
+  job->tmp_path = Qnil;
+  job->src_path = rb_str_new_frozen(FilePathValue(src_path));
+  job->dst_path = rb_str_new_frozen(FilePathValue(dst_path));
+  job->progress = progress == Qundef ? Qnil : progress;
+  if (!NIL_P(job->progress) && !rb_respond_to(job->progress, rb_intern("call"))) {
+    rb_raise(rb_eTypeError, "%s", "`progress:` must respond to call");
+  }
+  job->next_progress = FILE_PROGRESS_INTERVAL;
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+static VALUE
+rb_compress_file(int argc, VALUE *argv, VALUE self)
+{
+  VALUE src_path, dst_path, kwargs;
+  rb_scan_args(argc, argv, "20:", &src_path, &dst_path, &kwargs);
+
+  ID kwargs_keys[5];
+  kwargs_keys[0] = rb_intern("level");
+  kwargs_keys[1] = rb_intern("dict");
+  kwargs_keys[2] = rb_intern("checksum");
+  kwargs_keys[3] = rb_intern("threads");
+  kwargs_keys[4] = rb_intern("progress");
+  VALUE kwargs_values[5];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 5, kwargs_values);
+
+  struct file_job_t job;
+  file_job_init(&job, src_path, dst_path, kwargs_values[4]);
+  int threads = 0;
+  if (kwargs_values[3] != Qundef && kwargs_values[3] != Qnil) {
+    threads = NUM2INT(kwargs_values[3]);
+    if (threads < 1) {
+      rb_raise(rb_eArgError, "%s", "`threads:` must be a positive Integer");
+    }
+  }
+
+  job.cctx = zstd_ruby_create_cctx();
+  if (job.cctx == NULL) {
+    rb_raise(rb_eRuntimeError, "%s", "ZSTD_createCCtx error");
+  }
+  struct compress_options options = { kwargs_values[0], kwargs_values[1], kwargs_values[2] };
+  set_compress_options(job.cctx, &options);
+  if (threads > 1) {
+    /* libzstd compresses jobs of the same frame on its own worker threads */
+    ZSTD_CCtx_setParameter(job.cctx, ZSTD_c_nbWorkers, threads);
+  }
+  job.out_size = ZSTD_CStreamOutSize() * 8;
+
+  struct file_run_args args = { &job, compress_file_without_gvl, "compress" };
+  VALUE written = rb_ensure(file_run, (VALUE)&args, file_cleanup, (VALUE)&args);
+  RB_GC_GUARD(kwargs_values[1]);
+  return written;
+}
+#endif
+
+static VALUE
+rb_decompress_file(int argc, VALUE *argv, VALUE self)
+{
+  VALUE src_path, dst_path, kwargs;
+  rb_scan_args(argc, argv, "20:", &src_path, &dst_path, &kwargs);
+
+  ID kwargs_keys[3];
+  kwargs_keys[0] = rb_intern("dict");
+  kwargs_keys[1] = rb_intern("verify_checksum");
+  kwargs_keys[2] = rb_intern("progress");
+  VALUE kwargs_values[3];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 3, kwargs_values);
+
+  struct file_job_t job;
+  file_job_init(&job, src_path, dst_path, kwargs_values[2]);
+
+  job.dctx = zstd_ruby_create_dctx();
+  if (job.dctx == NULL) {
+    rb_raise(rb_eRuntimeError, "%s", "ZSTD_createDCtx error");
+  }
+  struct decompress_options options = { kwargs_values[0], kwargs_values[1] };
+  set_decompress_options(job.dctx, &options);
+  job.out_size = ZSTD_DStreamOutSize() * 8;
+
+  struct file_run_args args = { &job, decompress_file_without_gvl, "decompress" };
+  VALUE written = rb_ensure(file_run, (VALUE)&args, file_cleanup, (VALUE)&args);
+  RB_GC_GUARD(kwargs_values[0]);
+  return written;
+}
+
+void
+zstd_ruby_file_init(void)
+{
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  rb_define_module_function(rb_mZstd, "compress_file", rb_compress_file, -1);
+#endif
+  rb_define_module_function(rb_mZstd, "decompress_file", rb_decompress_file, -1);
+}
@@ -0,0 +1,151 @@
+#include "common.h"
+
+extern VALUE rb_mZstd;
+
+#define ZSTD_BLOCK_HEADER_SIZE 3
+#define ZSTD_CHECKSUM_SIZE 4
+
+/* Walks the block headers of a zstd frame. Returns the number of blocks, or (size_t)-1 when the frame is truncated */
+static size_t count_blocks(const unsigned char* src, size_t src_size, size_t header_size)
+{
+  size_t pos = header_size;
+  size_t blocks = 0;
+  for (;;) {
+    if (src_size - pos < ZSTD_BLOCK_HEADER_SIZE) {
+      return (size_t)-1;
+    }
+    uint32_t const block_header = (uint32_t)src[pos] | ((uint32_t)src[pos+1] << 8) | ((uint32_t)src[pos+2] << 16);
+    uint32_t const last_block = block_header & 1;
+    uint32_t const block_type = (block_header >> 1) & 3;
+    size_t const block_size = block_type == 1 ? 1 : (block_header >> 3); /* RLE blocks carry a single byte */
+    pos += ZSTD_BLOCK_HEADER_SIZE;
+    if (src_size - pos < block_size) {
+      return (size_t)-1;
+    }
+    pos += block_size;
+    blocks++;
+    if (last_block) {
+      return blocks;
+    }
+  }
+}
+
+/*
+ * ZSTD_findDecompressedSize, except that frames declaring more content than their blocks can hold
+ * (block count * block size max) make it return ZSTD_CONTENTSIZE_UNKNOWN: such a header must not
+ * size an output buffer upfront, and the streaming decoder reports the corruption instead.
+ */
+unsigned long long zstd_ruby_trusted_content_size(const char* src, size_t src_size)
+{
+  unsigned long long const content_size = ZSTD_findDecompressedSize(src, src_size);
+  if (content_size == ZSTD_CONTENTSIZE_ERROR || content_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+    return content_size;
+  }
+  unsigned long long bound = 0;
+  size_t offset = 0;
+  while (offset < src_size) {
+    size_t const frame_size = ZSTD_findFrameCompressedSize(src + offset, src_size - offset);
+    ZSTD_FrameHeader header;
+    if (ZSTD_isError(frame_size) || ZSTD_getFrameHeader(&header, src + offset, frame_size) != 0) {
+      return ZSTD_CONTENTSIZE_ERROR;
+    }
+    if (header.frameType == ZSTD_frame) {
+      size_t const blocks = count_blocks((const unsigned char*)src + offset, frame_size, header.headerSize);
+      if (blocks == (size_t)-1) {
+        return ZSTD_CONTENTSIZE_ERROR;
+      }
+      bound += (unsigned long long)blocks * header.blockSizeMax;
+    }
+    offset += frame_size;
+  }
+  return content_size > bound ? ZSTD_CONTENTSIZE_UNKNOWN : content_size;
+}
+
+static VALUE content_size_to_num(unsigned long long content_size)
+{
+  if (content_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+    return Qnil;
+  }
+  return ULL2NUM(content_size);
+}
+
+static VALUE rb_frame_info(int argc, VALUE *argv, VALUE self)
+{
+  VALUE input_value;
+  VALUE kwargs;
+  rb_scan_args(argc, argv, "10:", &input_value, &kwargs);
+
+  ID kwargs_keys[1];
+  kwargs_keys[0] = rb_intern("offset");
+  VALUE kwargs_values[1];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 1, kwargs_values);
+  size_t offset = (kwargs_values[0] != Qundef) ? NUM2SIZET(kwargs_values[0]) : 0;
+
+  StringValue(input_value);
+  size_t input_size = RSTRING_LEN(input_value);
+  if (offset > input_size) {
+    rb_raise(rb_eArgError, "offset is out of range");
+  }
+  const unsigned char* src = (const unsigned char*)RSTRING_PTR(input_value) + offset;
+  size_t src_size = input_size - offset;
+
+  ZSTD_FrameHeader header;
+  size_t const header_ret = ZSTD_getFrameHeader(&header, src, src_size);
+  if (ZSTD_isError(header_ret)) {
+    rb_raise(rb_eRuntimeError, "%s: %s", "not a zstd frame", ZSTD_getErrorName(header_ret));
+  }
+  if (header_ret > 0) {
+    rb_raise(rb_eRuntimeError, "%s", "frame header is incomplete");
+  }
+  size_t const compressed_size = ZSTD_findFrameCompressedSize(src, src_size);
+  if (ZSTD_isError(compressed_size)) {
+    rb_raise(rb_eRuntimeError, "%s: %s", "frame is incomplete", ZSTD_getErrorName(compressed_size));
+  }
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, ID2SYM(rb_intern("compressed_size")), SIZET2NUM(compressed_size));
+  if (header.frameType == ZSTD_skippableFrame) {
+    rb_hash_aset(result, ID2SYM(rb_intern("frame_type")), ID2SYM(rb_intern("skippable")));
+    rb_hash_aset(result, ID2SYM(rb_intern("content_size")), ULL2NUM(header.frameContentSize));
+    rb_hash_aset(result, ID2SYM(rb_intern("magic_variant")), UINT2NUM(header.dictID));
+    return result;
+  }
+  rb_hash_aset(result, ID2SYM(rb_intern("frame_type")), ID2SYM(rb_intern("zstd")));
+  rb_hash_aset(result, ID2SYM(rb_intern("content_size")), content_size_to_num(header.frameContentSize));
+  rb_hash_aset(result, ID2SYM(rb_intern("window_size")), ULL2NUM(header.windowSize));
+  rb_hash_aset(result, ID2SYM(rb_intern("block_size_max")), UINT2NUM(header.blockSizeMax));
+  rb_hash_aset(result, ID2SYM(rb_intern("header_size")), UINT2NUM(header.headerSize));
+  rb_hash_aset(result, ID2SYM(rb_intern("dict_id")), UINT2NUM(header.dictID));
+  rb_hash_aset(result, ID2SYM(rb_intern("checksum")), header.checksumFlag ? Qtrue : Qfalse);
+  rb_hash_aset(result, ID2SYM(rb_intern("block_count")), SIZET2NUM(count_blocks(src, compressed_size, header.headerSize)));
+  RB_GC_GUARD(input_value);
+  return result;
+}
+
+static VALUE rb_decompressed_size(VALUE self, VALUE input_value)
+{
+  StringValue(input_value);
+  unsigned long long const size = ZSTD_findDecompressedSize(RSTRING_PTR(input_value), RSTRING_LEN(input_value));
+  if (size == ZSTD_CONTENTSIZE_ERROR) {
+    rb_raise(rb_eRuntimeError, "%s", "not a zstd frame");
+  }
+  return content_size_to_num(size);
+}
+
+static VALUE rb_decompressed_size_bound(VALUE self, VALUE input_value)
+{
+  StringValue(input_value);
+  unsigned long long const bound = ZSTD_decompressBound(RSTRING_PTR(input_value), RSTRING_LEN(input_value));
+  if (bound == ZSTD_CONTENTSIZE_ERROR) {
+    rb_raise(rb_eRuntimeError, "%s", "not a zstd frame");
+  }
+  return ULL2NUM(bound);
+}
+
+void
+zstd_ruby_frame_info_init(void)
+{
+  rb_define_module_function(rb_mZstd, "frame_info", rb_frame_info, -1);
+  rb_define_module_function(rb_mZstd, "decompressed_size", rb_decompressed_size, 1);
+  rb_define_module_function(rb_mZstd, "decompressed_size_bound", rb_decompressed_size_bound, 1);
+}
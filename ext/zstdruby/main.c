@@ -7,6 +7,13 @@ void zstd_ruby_init(void);
 void zstd_ruby_skippable_frame_init(void);
 void zstd_ruby_streaming_compress_init(void);
 void zstd_ruby_streaming_decompress_init(void);
+void zstd_ruby_batch_init(void);
+void zstd_ruby_frame_info_init(void);
+void zstd_ruby_trace_init(void);
+void zstd_ruby_memory_init(void);
+void zstd_ruby_async_init(void);
+void zstd_ruby_file_init(void);
+void zstd_ruby_xxh64_init(void);
 
 RUBY_FUNC_EXPORTED void
 Init_zstdruby(void)
@@ -15,11 +22,28 @@ Init_zstdruby(void)
   rb_ext_ractor_safe(true);
 #endif
 
+#ifdef USE_SYSTEM_ZSTD
+  if (ZSTD_versionNumber() < ZSTD_VERSION_NUMBER) {
+    rb_warn("zstd-ruby was built against libzstd %s but libzstd %s is loaded", ZSTD_VERSION_STRING, ZSTD_versionString());
+  }
+#endif
+
   rb_mZstd = rb_define_module("Zstd");
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
   rb_cCDict = rb_define_class_under(rb_mZstd, "CDict", rb_cObject);
+#endif
   rb_cDDict = rb_define_class_under(rb_mZstd, "DDict", rb_cObject);
   zstd_ruby_init();
   zstd_ruby_skippable_frame_init();
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
   zstd_ruby_streaming_compress_init();
+#endif
   zstd_ruby_streaming_decompress_init();
+  zstd_ruby_batch_init();
+  zstd_ruby_frame_info_init();
+  zstd_ruby_trace_init();
+  zstd_ruby_memory_init();
+  zstd_ruby_async_init();
+  zstd_ruby_file_init();
+  zstd_ruby_xxh64_init();
 }
@@ -0,0 +1,368 @@
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "ruby/io.h"
+#ifdef HAVE_RUBY_IO_BUFFER_H
+#include "ruby/io/buffer.h"
+#endif
+
+/*
+ * File and IO::Buffer inputs are read in place: a File is mapped read-only with a sequential
+ * access hint, and an IO::Buffer is locked while it is read. The API function then runs on a
+ * String that points at those bytes without copying them. Such a String does not outlive the call.
+ */
+
+#define MAPPED_INPUTS_MAX 8
+
+struct mapped_input_t {
+  VALUE source;
+  VALUE str;
+  bool locked;
+  void* map;
+  size_t map_size;
+};
+
+struct mapped_call_t {
+  zstd_ruby_input_func func;
+  int argc;
+  VALUE* argv;
+  VALUE self;
+  struct mapped_input_t inputs[MAPPED_INPUTS_MAX];
+  int count;
+};
+
+static int
+io_fd(VALUE io)
+{
+#ifdef HAVE_RB_IO_DESCRIPTOR
+  return rb_io_descriptor(io);
+#else
+  rb_io_t* fptr;
+  GetOpenFile(io, fptr);
+  return fptr->fd;
+#endif
+}
+
+bool
+zstd_ruby_mappable_p(VALUE input)
+{
+  if (RB_TYPE_P(input, T_STRING)) {
+    return false;
+  }
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+  if (rb_obj_is_kind_of(input, rb_cIOBuffer)) {
+    return true;
+  }
+#endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+  return RTEST(rb_obj_is_kind_of(input, rb_cFile));
+#else
+  return false;
+#endif
+}
+
+static void
+mapped_input_acquire(struct mapped_input_t* input)
+{
+  const void* base = NULL;
+  size_t size = 0;
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+  if (rb_obj_is_kind_of(input->source, rb_cIOBuffer)) {
+    rb_io_buffer_lock(input->source);
+    input->locked = true;
+    rb_io_buffer_get_bytes_for_reading(input->source, &base, &size);
+    input->str = rb_obj_freeze(rb_str_new_static(base, (long)size));
+    return;
+  }
+#endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+  int const fd = io_fd(input->source);
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    rb_sys_fail("fstat");
+  }
+  /*
+   * Pipes, devices, sockets and files whose size is not known up front (/proc, /sys report 0)
+   * cannot be mapped; they are read from the current position like IO#read does.
+   */
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    VALUE str = rb_funcall(input->source, rb_intern("read"), 0);
+    input->str = rb_obj_freeze(NIL_P(str) ? rb_str_new(NULL, 0) : str);
+    return;
+  }
+  /* a regular file is read whole, independently of the current position */
+  void* const map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    rb_sys_fail("mmap");
+  }
+  input->map = map;
+  input->map_size = (size_t)st.st_size;
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+  madvise(map, input->map_size, MADV_SEQUENTIAL);
+#endif
+  base = map;
+  size = input->map_size;
+  input->str = rb_obj_freeze(rb_str_new_static(base, (long)size));
+#endif
+}
+
+static VALUE
+mapped_call_body(VALUE arg)
+{
+  struct mapped_call_t* call = (struct mapped_call_t*)arg;
+  for (int i = 0; i < call->argc; i++) {
+    if (call->count < MAPPED_INPUTS_MAX && zstd_ruby_mappable_p(call->argv[i])) {
+      struct mapped_input_t* const input = &call->inputs[call->count++];
+      input->source = call->argv[i];
+      mapped_input_acquire(input);
+      call->argv[i] = input->str;
+    }
+  }
+  return call->func(call->argc, call->argv, call->self);
+}
+
+static VALUE
+mapped_call_ensure(VALUE arg)
+{
+  struct mapped_call_t* call = (struct mapped_call_t*)arg;
+  for (int i = 0; i < call->count; i++) {
+    struct mapped_input_t* const input = &call->inputs[i];
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+    if (input->map != NULL) {
+      munmap(input->map, input->map_size);
+    }
+#endif
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+    if (input->locked) {
+      rb_io_buffer_unlock(input->source);
+    }
+#endif
+  }
+  return Qnil;
+}
+
+VALUE
+zstd_ruby_with_mapped_inputs(int argc, const VALUE* argv, VALUE self, zstd_ruby_input_func func)
+{
+  struct mapped_call_t call;
+  memset(&call, 0, sizeof(call));
+  call.func = func;
+  call.argc = argc;
+  /* on the machine stack, so the borrowed Strings are seen by GC */
+  call.argv = ALLOCA_N(VALUE, argc);
+  MEMCPY(call.argv, argv, VALUE, argc);
+  call.self = self;
+  for (int i = 0; i < MAPPED_INPUTS_MAX; i++) {
+    call.inputs[i].str = Qnil;
+  }
+  return rb_ensure(mapped_call_body, (VALUE)&call, mapped_call_ensure, (VALUE)&call);
+}
+
+struct decompress_to_file_t {
+  ZSTD_DCtx* dctx;
+  const char* src;
+  size_t src_size;
+  VALUE file;
+  char* dst;
+  size_t dst_size;
+  void* map;
+  char* buf;
+  ZSTD_inBuffer in;
+  size_t pending;
+  size_t flushed;
+  bool finished;
+  int fd;
+  bool resized;
+  bool done;
+  size_t ret;
+  int err;
+  size_t written;
+};
+
+static void*
+decompress_to_map_without_gvl(void* arg)
+{
+  struct decompress_to_file_t* job = arg;
+  job->ret = ZSTD_decompressDCtx(job->dctx, job->dst, job->dst_size, job->src, job->src_size);
+  if (!ZSTD_isError(job->ret)) {
+    job->written = job->ret;
+  }
+  return NULL;
+}
+
+/*
+ * Stops with err set to EAGAIN when a non-blocking fd (e.g. a pipe from IO.pipe) is full; the
+ * caller waits for it with the GVL and calls again, which first writes what is still pending.
+ */
+static void*
+decompress_to_fd_without_gvl(void* arg)
+{
+  struct decompress_to_file_t* job = arg;
+  for (;;) {
+    while (job->flushed < job->pending) {
+      ssize_t const n = write(job->fd, job->dst + job->flushed, job->pending - job->flushed);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        job->err = errno;
+        return NULL;
+      }
+      job->flushed += (size_t)n;
+      job->written += (size_t)n;
+    }
+    if (job->finished) {
+      return NULL;
+    }
+    ZSTD_outBuffer out = { job->dst, job->dst_size, 0 };
+    job->ret = ZSTD_decompressStream(job->dctx, &out, &job->in);
+    if (ZSTD_isError(job->ret)) {
+      return NULL;
+    }
+    job->pending = out.pos;
+    job->flushed = 0;
+    /* done once the input is consumed and either the frame is complete or nothing more comes out */
+    job->finished = job->in.pos == job->in.size && (job->ret == 0 || out.pos < out.size);
+  }
+}
+
+static bool
+fd_wait_writable(int err)
+{
+#ifdef EWOULDBLOCK
+  if (err == EWOULDBLOCK) {
+    return true;
+  }
+#endif
+  return err == EAGAIN;
+}
+
+static bool
+decompress_to_map(struct decompress_to_file_t* job)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+  /* the declared size is only used when the blocks can add up to it, not to grow the file to 1 TB */
+  unsigned long long const content_size = zstd_ruby_trusted_content_size(job->src, job->src_size);
+  if (content_size == ZSTD_CONTENTSIZE_ERROR || content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+      content_size == 0 || content_size > SIZE_MAX) {
+    return false;
+  }
+  if (ftruncate(job->fd, (off_t)content_size) < 0) {
+    return false;
+  }
+  job->resized = true;
+  void* const map = mmap(NULL, (size_t)content_size, PROT_READ | PROT_WRITE, MAP_SHARED, job->fd, 0);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+  madvise(map, (size_t)content_size, MADV_SEQUENTIAL);
+#endif
+  job->map = map;
+  job->dst = map;
+  job->dst_size = (size_t)content_size;
+  rb_thread_call_without_gvl(decompress_to_map_without_gvl, job, NULL, NULL);
+  return true;
+#else
+  return false;
+#endif
+}
+
+static VALUE
+decompress_to_file_body(VALUE arg)
+{
+  struct decompress_to_file_t* job = (struct decompress_to_file_t*)arg;
+  job->fd = io_fd(job->file);
+  struct stat st;
+  if (fstat(job->fd, &st) < 0) {
+    rb_sys_fail("fstat");
+  }
+  /* pipes, sockets and files opened for appending are written at their current position */
+  bool rewrite = S_ISREG(st.st_mode);
+#ifdef F_GETFL
+  int const flags = fcntl(job->fd, F_GETFL);
+  if (flags >= 0 && (flags & O_APPEND)) {
+    rewrite = false;
+  }
+#endif
+
+  if (!rewrite || !decompress_to_map(job)) {
+    if (rewrite) {
+      /* a file that cannot be truncated is written over from its start */
+      if (ftruncate(job->fd, 0) == 0) {
+        job->resized = true;
+      }
+      lseek(job->fd, 0, SEEK_SET);
+    }
+    job->dst_size = ZSTD_DStreamOutSize() * 8;
+    job->buf = malloc(job->dst_size);
+    if (job->buf == NULL) {
+      rb_raise(rb_eNoMemError, "%s", "failed to allocate the output buffer");
+    }
+    job->dst = job->buf;
+    job->in = (ZSTD_inBuffer){ job->src, job->src_size, 0 };
+    for (;;) {
+      job->err = 0;
+      rb_thread_call_without_gvl(decompress_to_fd_without_gvl, job, NULL, NULL);
+      if (!fd_wait_writable(job->err)) {
+        break;
+      }
+      rb_thread_fd_writable(job->fd);
+    }
+    if (job->err != 0) {
+      rb_syserr_fail(job->err, "write");
+    }
+    if (!ZSTD_isError(job->ret) && job->ret != 0) {
+      rb_raise(rb_eRuntimeError, "decompress error error code: %s", "truncated frame");
+    }
+  }
+  if (ZSTD_isError(job->ret)) {
+    rb_raise(rb_eRuntimeError, "decompress error error code: %s", ZSTD_getErrorName(job->ret));
+  }
+  job->done = true;
+  return SIZET2NUM(job->written);
+}
+
+static VALUE
+decompress_to_file_ensure(VALUE arg)
+{
+  struct decompress_to_file_t* job = (struct decompress_to_file_t*)arg;
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+  if (job->map != NULL) {
+    munmap(job->map, job->dst_size);
+  }
+#endif
+  free(job->buf);
+  ZSTD_freeDCtx(job->dctx);
+  /* a failed call leaves an empty file rather than a partial one, or one grown to the declared size */
+  if (!job->done && job->resized && ftruncate(job->fd, 0) < 0) {
+    /* the error being raised is more useful than this one */
+  }
+  return Qnil;
+}
+
+/*
+ * Zstd.decompress(input, output: file): a regular file is truncated to the decompressed size and
+ * filled through a shared mapping. Frames without a trusted content size, files that cannot be
+ * resized or mapped for writing (e.g. opened write-only), pipes and sockets are written with
+ * write(2) instead. dctx is freed in all cases.
+ */
+VALUE
+zstd_ruby_decompress_to_file(ZSTD_DCtx* dctx, const char* src, size_t src_size, VALUE file)
+{
+  struct decompress_to_file_t job;
+  memset(&job, 0, sizeof(job));
+  job.dctx = dctx;
+  job.src = src;
+  job.src_size = src_size;
+  job.file = file;
+  job.fd = -1;
+  return rb_ensure(decompress_to_file_body, (VALUE)&job, decompress_to_file_ensure, (VALUE)&job);
+}
@@ -0,0 +1,234 @@
+#include "common.h"
+#include "threading.h"
+#ifdef HAVE_RB_RACTOR_LOCAL_STORAGE_PTR_NEWKEY
+#include <ruby/ractor.h>
+#endif
+
+extern VALUE rb_mZstd;
+
+/*
+ * Counting allocator handed to libzstd through ZSTD_customMem. Every block carries its size in a
+ * header so frees can be accounted; libzstd may allocate from its worker threads, so the counters
+ * are guarded by a native mutex instead of the GVL.
+ */
+
+#define MEMORY_HEADER_SIZE 16 /* keeps the returned pointer aligned like malloc */
+
+static ZSTD_pthread_mutex_t memory_mutex;
+static volatile int memory_stats_enabled = 0;
+static unsigned long long memory_allocations = 0;
+static unsigned long long memory_frees = 0;
+static unsigned long long memory_allocated_bytes = 0;
+static unsigned long long memory_current_bytes = 0;
+static unsigned long long memory_peak_bytes = 0;
+
+static void* counting_alloc(void* opaque, size_t size)
+{
+  (void)opaque;
+  unsigned char* const block = malloc(MEMORY_HEADER_SIZE + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  memcpy(block, &size, sizeof(size));
+
+  ZSTD_pthread_mutex_lock(&memory_mutex);
+  memory_allocations++;
+  memory_allocated_bytes += size;
+  memory_current_bytes += size;
+  if (memory_current_bytes > memory_peak_bytes) {
+    memory_peak_bytes = memory_current_bytes;
+  }
+  ZSTD_pthread_mutex_unlock(&memory_mutex);
+  return block + MEMORY_HEADER_SIZE;
+}
+
+static void counting_free(void* opaque, void* address)
+{
+  (void)opaque;
+  if (address == NULL) {
+    return;
+  }
+  unsigned char* const block = (unsigned char*)address - MEMORY_HEADER_SIZE;
+  size_t size;
+  memcpy(&size, block, sizeof(size));
+
+  ZSTD_pthread_mutex_lock(&memory_mutex);
+  memory_frees++;
+  memory_current_bytes -= size;
+  ZSTD_pthread_mutex_unlock(&memory_mutex);
+  free(block);
+}
+
+static const ZSTD_customMem counting_mem = { counting_alloc, counting_free, NULL };
+
+/* contexts remember their allocator, so disabling the stats later frees them correctly */
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+ZSTD_CCtx* zstd_ruby_create_cctx(void)
+{
+  return memory_stats_enabled ? ZSTD_createCCtx_advanced(counting_mem) : ZSTD_createCCtx();
+}
+#endif
+
+ZSTD_DCtx* zstd_ruby_create_dctx(void)
+{
+  return memory_stats_enabled ? ZSTD_createDCtx_advanced(counting_mem) : ZSTD_createDCtx();
+}
+
+ZSTD_DDict* zstd_ruby_create_ddict(const void* dict, size_t dict_size)
+{
+  if (!memory_stats_enabled) {
+    return ZSTD_createDDict(dict, dict_size);
+  }
+  return ZSTD_createDDict_advanced(dict, dict_size, ZSTD_dlm_byCopy, ZSTD_dct_auto, counting_mem);
+}
+
+/*
+ * One-shot Zstd.compress/decompress reuse a context per Ractor instead of creating one per call.
+ * A context is taken out of the cache while it is used without the GVL, so another thread of the
+ * same Ractor gets a fresh one. Contexts grown by large inputs or high levels are not kept, and the
+ * cache is bypassed while Zstd.malloc_stats_enabled is set, so allocations stay accounted per call.
+ */
+
+#define CONTEXT_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+struct context_cache_t {
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  ZSTD_CCtx* cctx;
+#endif
+  ZSTD_DCtx* dctx;
+};
+
+#ifdef HAVE_RB_RACTOR_LOCAL_STORAGE_PTR_NEWKEY
+static void context_cache_free(void* ptr)
+{
+  struct context_cache_t* cache = ptr;
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+  ZSTD_freeCCtx(cache->cctx);
+#endif
+  ZSTD_freeDCtx(cache->dctx);
+  free(cache);
+}
+
+static const struct rb_ractor_local_storage_type context_cache_type = { NULL, context_cache_free };
+static rb_ractor_local_key_t context_cache_key;
+
+static struct context_cache_t* context_cache(void)
+{
+  struct context_cache_t* cache = rb_ractor_local_storage_ptr(context_cache_key);
+  if (cache == NULL) {
+    cache = calloc(1, sizeof(struct context_cache_t));
+    if (cache != NULL) {
+      rb_ractor_local_storage_ptr_set(context_cache_key, cache);
+    }
+  }
+  return cache;
+}
+#else
+static struct context_cache_t main_context_cache;
+
+static struct context_cache_t* context_cache(void)
+{
+  return &main_context_cache;
+}
+#endif
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+ZSTD_CCtx* zstd_ruby_acquire_cctx(void)
+{
+  struct context_cache_t* const cache = context_cache();
+  if (cache == NULL || cache->cctx == NULL || memory_stats_enabled) {
+    return zstd_ruby_create_cctx();
+  }
+  ZSTD_CCtx* const ctx = cache->cctx;
+  cache->cctx = NULL;
+  ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+  return ctx;
+}
+
+void zstd_ruby_release_cctx(ZSTD_CCtx* ctx)
+{
+  struct context_cache_t* const cache = context_cache();
+  if (cache == NULL || cache->cctx != NULL || memory_stats_enabled || ZSTD_sizeof_CCtx(ctx) > CONTEXT_CACHE_MAX_SIZE) {
+    ZSTD_freeCCtx(ctx);
+    return;
+  }
+  cache->cctx = ctx;
+}
+#endif
+
+ZSTD_DCtx* zstd_ruby_acquire_dctx(void)
+{
+  struct context_cache_t* const cache = context_cache();
+  if (cache == NULL || cache->dctx == NULL || memory_stats_enabled) {
+    return zstd_ruby_create_dctx();
+  }
+  ZSTD_DCtx* const dctx = cache->dctx;
+  cache->dctx = NULL;
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+  return dctx;
+}
+
+void zstd_ruby_release_dctx(ZSTD_DCtx* dctx)
+{
+  struct context_cache_t* const cache = context_cache();
+  if (cache == NULL || cache->dctx != NULL || memory_stats_enabled || ZSTD_sizeof_DCtx(dctx) > CONTEXT_CACHE_MAX_SIZE) {
+    ZSTD_freeDCtx(dctx);
+    return;
+  }
+  cache->dctx = dctx;
+}
+
+static VALUE rb_malloc_stats_enabled_p(VALUE self)
+{
+  return memory_stats_enabled ? Qtrue : Qfalse;
+}
+
+static VALUE rb_set_malloc_stats_enabled(VALUE self, VALUE enabled)
+{
+  memory_stats_enabled = RTEST(enabled);
+  return enabled;
+}
+
+static VALUE rb_malloc_stats(VALUE self)
+{
+  ZSTD_pthread_mutex_lock(&memory_mutex);
+  unsigned long long const allocations = memory_allocations;
+  unsigned long long const frees = memory_frees;
+  unsigned long long const allocated_bytes = memory_allocated_bytes;
+  unsigned long long const current_bytes = memory_current_bytes;
+  unsigned long long const peak_bytes = memory_peak_bytes;
+  ZSTD_pthread_mutex_unlock(&memory_mutex);
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, ID2SYM(rb_intern("allocations")), ULL2NUM(allocations));
+  rb_hash_aset(result, ID2SYM(rb_intern("frees")), ULL2NUM(frees));
+  rb_hash_aset(result, ID2SYM(rb_intern("allocated_bytes")), ULL2NUM(allocated_bytes));
+  rb_hash_aset(result, ID2SYM(rb_intern("current_bytes")), ULL2NUM(current_bytes));
+  rb_hash_aset(result, ID2SYM(rb_intern("peak_bytes")), ULL2NUM(peak_bytes));
+  return result;
+}
+
+/* live blocks stay accounted in current_bytes, so their frees keep the counters consistent */
+static VALUE rb_reset_malloc_stats(VALUE self)
+{
+  ZSTD_pthread_mutex_lock(&memory_mutex);
+  memory_allocations = 0;
+  memory_frees = 0;
+  memory_allocated_bytes = 0;
+  memory_peak_bytes = memory_current_bytes;
+  ZSTD_pthread_mutex_unlock(&memory_mutex);
+  return Qnil;
+}
+
+void
+zstd_ruby_memory_init(void)
+{
+  ZSTD_pthread_mutex_init(&memory_mutex, NULL);
+#ifdef HAVE_RB_RACTOR_LOCAL_STORAGE_PTR_NEWKEY
+  context_cache_key = rb_ractor_local_storage_ptr_newkey(&context_cache_type);
+#endif
+  rb_define_module_function(rb_mZstd, "malloc_stats_enabled?", rb_malloc_stats_enabled_p, 0);
+  rb_define_module_function(rb_mZstd, "malloc_stats_enabled=", rb_set_malloc_stats_enabled, 1);
+  rb_define_module_function(rb_mZstd, "malloc_stats", rb_malloc_stats, 0);
+  rb_define_module_function(rb_mZstd, "reset_malloc_stats", rb_reset_malloc_stats, 0);
+}
@@ -0,0 +1,35 @@
+# Training workload for `--enable-pgo`, run by extconf.rb against the instrumented extension.
+# Uses the benchmark suite corpora in a source checkout, and the bundled C sources otherwise.
+require 'zstd-ruby/zstdruby'
+
+corpus_file = File.expand_path('../../benchmarks/suite/corpus.rb', __dir__)
+samples =
+  if File.exist?(corpus_file)
+    require corpus_file
+    Zstd::Bench::Corpus::KINDS.flat_map do |kind|
+      [Zstd::Bench::Corpus.generate(kind, 4 * 1024), Zstd::Bench::Corpus.generate(kind, 4 * 1024 * 1024)]
+    end
+  else
+    sources = Dir[File.join(__dir__, 'libzstd', '**', '*.{c,h}')].sort.map { |f| File.binread(f) }.join
+    [sources.byteslice(0, 4 * 1024), sources, Random.new(0).bytes(1024 * 1024)]
+  end
+dictionary = samples.first
+
+[-1, 1, 3, 6, 9].each do |level|
+  samples.each do |data|
+    compressed = Zstd.compress(data, level: level)
+    raise 'PGO training roundtrip failed' unless Zstd.decompress(compressed) == data
+
+    stream = Zstd::StreamingCompress.new(level: level)
+    chunks = (0...data.bytesize).step(64 * 1024).map { |pos| data.byteslice(pos, 64 * 1024) }
+    streamed = chunks.map { |chunk| stream.compress(chunk) }.join << stream.finish
+    decoder = Zstd::StreamingDecompress.new
+    (0...streamed.bytesize).step(16 * 1024) { |pos| decoder.decompress(streamed.byteslice(pos, 16 * 1024)) }
+  end
+end
+
+cdict = Zstd::CDict.new(dictionary)
+ddict = Zstd::DDict.new(dictionary)
+samples.each do |data|
+  5.times { Zstd.decompress(Zstd.compress(data, dict: cdict), dict: ddict) }
+end
@@ -1,7 +1,11 @@
 #include "common.h"
+#include "ruby/encoding.h"
 
 extern VALUE rb_mZstd;
 
+/* ZSTD_writeSkippableFrame is part of libzstd/compress */
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+/* Copies the data after the frame; Zstd.compress(metadata:) and StreamingCompress#write_skippable_frame do not */
 static VALUE rb_write_skippable_frame(int argc, VALUE *argv, VALUE self)
 {
   VALUE input_value;
@@ -17,47 +21,116 @@ static VALUE rb_write_skippable_frame(int argc, VALUE *argv, VALUE self)
 
   StringValue(input_value);
   StringValue(skip_value);
-  char* input_data = RSTRING_PTR(input_value);
   size_t input_size = RSTRING_LEN(input_value);
-  char* skip_data = RSTRING_PTR(skip_value);
   size_t skip_size = RSTRING_LEN(skip_value);
 
-  size_t dst_size = input_size + ZSTD_SKIPPABLEHEADERSIZE + skip_size;
-  VALUE output = rb_str_new(input_data, dst_size);
+  size_t dst_size = ZSTD_SKIPPABLEHEADERSIZE + skip_size + input_size;
+  VALUE output = rb_str_new(NULL, dst_size);
   char* output_data = RSTRING_PTR(output);
-  size_t output_size = ZSTD_writeSkippableFrame((void*)output_data, dst_size, (const void*)skip_data, skip_size, magic_variant);
-  if (ZSTD_isError(output_size)) {
-    rb_raise(rb_eRuntimeError, "%s: %s", "write skippable frame failed", ZSTD_getErrorName(output_size));
+  size_t skippable_size = ZSTD_writeSkippableFrame((void*)output_data, dst_size, (const void*)RSTRING_PTR(skip_value), skip_size, magic_variant);
+  if (ZSTD_isError(skippable_size)) {
+    rb_raise(rb_eRuntimeError, "%s: %s", "write skippable frame failed", ZSTD_getErrorName(skippable_size));
   }
+  memcpy(output_data + skippable_size, RSTRING_PTR(input_value), input_size);
 
-  rb_str_resize(output, output_size);
+  rb_str_resize(output, skippable_size + input_size);
   return output;
 }
+#endif
+
+static unsigned read_le32(const char* src)
+{
+  const unsigned char* p = (const unsigned char*)src;
+  return (unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/* Returns the frame size, or 0 when there is no skippable frame at offset */
+static size_t skippable_frame_size(const char* input_data, size_t input_size, size_t offset)
+{
+  if (offset > input_size || ZSTD_isSkippableFrame(input_data + offset, input_size - offset) == 0) {
+    return 0;
+  }
+  if (input_size - offset < ZSTD_SKIPPABLEHEADERSIZE) {
+    rb_raise(rb_eRuntimeError, "%s: %s", "read skippable frame failed", ZSTD_getErrorName((size_t)-ZSTD_error_srcSize_wrong));
+  }
+  size_t const frame_size = ZSTD_SKIPPABLEHEADERSIZE + (size_t)read_le32(input_data + offset + 4);
+  if (frame_size > input_size - offset) {
+    rb_raise(rb_eRuntimeError, "%s: %s", "read skippable frame failed", ZSTD_getErrorName((size_t)-ZSTD_error_srcSize_wrong));
+  }
+  return frame_size;
+}
+
+/* sliced by bytes, sharing the buffer of input_value instead of copying the content; binary like the other outputs */
+static VALUE skippable_frame_payload(VALUE input_value, size_t offset, size_t frame_size)
+{
+  VALUE payload = rb_str_subseq(input_value, offset + ZSTD_SKIPPABLEHEADERSIZE, frame_size - ZSTD_SKIPPABLEHEADERSIZE);
+  rb_enc_associate(payload, rb_ascii8bit_encoding());
+  return payload;
+}
 
-static VALUE rb_read_skippable_frame(VALUE self, VALUE input_value)
+static VALUE rb_read_skippable_frame(int argc, VALUE *argv, VALUE self)
 {
+  VALUE input_value;
+  VALUE kwargs;
+  rb_scan_args(argc, argv, "10:", &input_value, &kwargs);
+
+  ID kwargs_keys[2];
+  kwargs_keys[0] = rb_intern("offset");
+  kwargs_keys[1] = rb_intern("with_magic_variant");
+  VALUE kwargs_values[2];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 2, kwargs_values);
+  size_t offset = (kwargs_values[0] != Qundef) ? NUM2SIZET(kwargs_values[0]) : 0;
+  bool with_magic_variant = kwargs_values[1] != Qundef && RTEST(kwargs_values[1]);
+
+  StringValue(input_value);
   char* input_data = RSTRING_PTR(input_value);
   size_t input_size = RSTRING_LEN(input_value);
 
-  if (ZSTD_isSkippableFrame(input_data, input_size) == 0) {
+  size_t const frame_size = skippable_frame_size(input_data, input_size, offset);
+  if (frame_size == 0) {
     return Qnil;
   }
-  // ref https://github.com/facebook/zstd/blob/321490cd5b9863433b3d44816d04012874e5ecdb/tests/fuzzer.c#L2096
-  size_t const skipLen = 129 * 1024;
-  VALUE output = rb_str_new(NULL, skipLen);
-  char* output_data = RSTRING_PTR(output);
-  unsigned readMagic;
-  size_t output_size = ZSTD_readSkippableFrame((void*)output_data, skipLen, &readMagic, (const void*)input_data, input_size);
-  if (ZSTD_isError(output_size)) {
-    rb_raise(rb_eRuntimeError, "%s: %s", "read skippable frame failed", ZSTD_getErrorName(output_size));
+  VALUE output = skippable_frame_payload(input_value, offset, frame_size);
+  if (with_magic_variant) {
+    unsigned const magic_variant = read_le32(input_data + offset) - ZSTD_MAGIC_SKIPPABLE_START;
+    return rb_ary_new_from_args(2, output, UINT2NUM(magic_variant));
   }
-  rb_str_resize(output, output_size);
   return output;
 }
 
+static VALUE rb_each_skippable_frame(VALUE self, VALUE input_value)
+{
+  RETURN_ENUMERATOR(self, 1, &input_value);
+  StringValue(input_value);
+
+  size_t offset = 0;
+  while (offset < (size_t)RSTRING_LEN(input_value)) {
+    /* re-read the buffer every round, the block may have run GC */
+    const char* input_data = RSTRING_PTR(input_value);
+    size_t const input_size = RSTRING_LEN(input_value);
+    size_t frame_size = skippable_frame_size(input_data, input_size, offset);
+    if (frame_size != 0) {
+      unsigned const magic_variant = read_le32(input_data + offset) - ZSTD_MAGIC_SKIPPABLE_START;
+      VALUE frame = skippable_frame_payload(input_value, offset, frame_size);
+      offset += frame_size;
+      rb_yield_values(2, frame, UINT2NUM(magic_variant));
+      continue;
+    }
+    frame_size = ZSTD_findFrameCompressedSize(input_data + offset, input_size - offset);
+    if (ZSTD_isError(frame_size)) {
+      rb_raise(rb_eRuntimeError, "%s: %s", "read skippable frame failed", ZSTD_getErrorName(frame_size));
+    }
+    offset += frame_size;
+  }
+  return input_value;
+}
+
 void
 zstd_ruby_skippable_frame_init(void)
 {
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
   rb_define_module_function(rb_mZstd, "write_skippable_frame", rb_write_skippable_frame, -1);
-  rb_define_module_function(rb_mZstd, "read_skippable_frame", rb_read_skippable_frame, 1);
+#endif
+  rb_define_module_function(rb_mZstd, "read_skippable_frame", rb_read_skippable_frame, -1);
+  rb_define_module_function(rb_mZstd, "each_skippable_frame", rb_each_skippable_frame, 1);
 }
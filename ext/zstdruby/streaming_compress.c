@@ -5,6 +5,17 @@ struct streaming_compress_t {
   VALUE buf;
   size_t buf_size;
   VALUE pending;   /* accumulate compressed bytes produced by write() */
+  bool in_frame;   /* true once input has been fed to the current frame */
+  unsigned long long total_in;
+  unsigned long long total_out;
+  bool adapt;      /* adjust the compression level between min_level and max_level while compressing */
+  int level;
+  int min_level;
+  int max_level;
+  unsigned last_job_id;
+  unsigned input_presented;
+  unsigned input_blocked;
+  ZSTD_frameProgression last_progress;
 };
 
 static void
@@ -34,7 +45,9 @@ streaming_compress_free(void *p)
 static size_t
 streaming_compress_memsize(const void *p)
 {
-    return sizeof(struct streaming_compress_t);
+    const struct streaming_compress_t *sc = p;
+    /* include the off-heap context so ObjectSpace.memsize_of reports it */
+    return sizeof(struct streaming_compress_t) + (sc->ctx != NULL ? ZSTD_sizeof_CCtx(sc->ctx) : 0);
 }
 
 #ifdef HAVE_RB_GC_MARK_MOVABLE
@@ -69,9 +82,131 @@ rb_streaming_compress_allocate(VALUE klass)
   RB_OBJ_WRITE(obj, &sc->buf, Qnil);
   sc->buf_size = 0;
   RB_OBJ_WRITE(obj, &sc->pending, Qnil);
+  sc->in_frame = false;
+  sc->total_in = 0;
+  sc->total_out = 0;
+  sc->adapt = false;
   return obj;
 }
 
+#define ADAPT_DEFAULT_MIN_LEVEL 1
+#define ADAPT_DEFAULT_MAX_LEVEL 19
+#define ADAPT_WORKERS 1
+
+static void
+reset_adapt_state(struct streaming_compress_t* sc)
+{
+  ZSTD_frameProgression const zero = { 0 };
+  sc->last_job_id = 0;
+  sc->input_presented = 0;
+  sc->input_blocked = 0;
+  sc->last_progress = zero;
+}
+
+/*
+ * Same heuristic as `zstd --adapt`, evaluated once per new job:
+ * input that never waited for the workers means compression has headroom, so the level goes up;
+ * input that waited often while arriving at least as fast as it is compressed means compression
+ * is the bottleneck, so the level goes down.
+ */
+static void
+adapt_compression_level(struct streaming_compress_t* sc)
+{
+  if (!sc->adapt) {
+    return;
+  }
+  ZSTD_frameProgression const progress = ZSTD_getFrameProgression(sc->ctx);
+  if (progress.currentJobID <= sc->last_job_id) {
+    return;
+  }
+  sc->last_job_id = progress.currentJobID;
+  if (sc->input_presented == 0 && progress.currentJobID > ADAPT_WORKERS + 1) {
+    /* only calls that filled the output buffer: the progression is compared over a longer period */
+    return;
+  }
+
+  int level = sc->level;
+  /* skip the warm up period until all workers got a job */
+  if (progress.currentJobID > ADAPT_WORKERS + 1) {
+    unsigned long long const ingested = progress.ingested - sc->last_progress.ingested;
+    unsigned long long const consumed = progress.consumed - sc->last_progress.consumed;
+    if (sc->input_blocked == 0) {
+      level++;
+    } else if (sc->input_blocked > sc->input_presented / 8 && ingested * 33 / 32 > consumed) {
+      level--;
+    }
+  }
+  sc->last_progress = progress;
+  sc->input_presented = 0;
+  sc->input_blocked = 0;
+
+  if (level == 0) {
+    /* level 0 means the default level */
+    level += level > sc->level ? 1 : -1;
+  }
+  if (level > sc->max_level) {
+    level = sc->max_level;
+  }
+  if (level < sc->min_level) {
+    level = sc->min_level;
+  }
+  if (level != sc->level && !ZSTD_isError(ZSTD_CCtx_setParameter(sc->ctx, ZSTD_c_compressionLevel, level))) {
+    sc->level = level;
+  }
+}
+
+struct adapt_params {
+  bool adapt;
+  int min_level;
+  int max_level;
+};
+
+/* runs before the context is created, so that a bad value cannot leak it */
+static void
+parse_adapt_params(struct adapt_params* params, VALUE adapt_value, VALUE min_level_value, VALUE max_level_value)
+{
+  params->adapt = adapt_value != Qundef && RTEST(adapt_value);
+  if (!params->adapt) {
+    if (min_level_value != Qundef || max_level_value != Qundef) {
+      rb_raise(rb_eArgError, "`min_level:` and `max_level:` require `adapt: true`");
+    }
+    return;
+  }
+  params->min_level = min_level_value != Qundef ? convert_compression_level(NULL, min_level_value) : ADAPT_DEFAULT_MIN_LEVEL;
+  params->max_level = max_level_value != Qundef ? convert_compression_level(NULL, max_level_value) : ADAPT_DEFAULT_MAX_LEVEL;
+  if (params->min_level > params->max_level) {
+    rb_raise(rb_eArgError, "`min_level:` must not be greater than `max_level:`");
+  }
+}
+
+static void
+set_adapt_params(struct streaming_compress_t* sc, ZSTD_CCtx* const ctx, const struct adapt_params* params)
+{
+  if (!params->adapt) {
+    return;
+  }
+  /* the compression level can only be changed in the middle of a frame in multi-threaded mode */
+  if (ZSTD_isError(ZSTD_CCtx_setParameter(ctx, ZSTD_c_nbWorkers, ADAPT_WORKERS))) {
+    ZSTD_freeCCtx(ctx);
+    rb_raise(rb_eRuntimeError, "%s", "`adapt:` requires libzstd built with multithreading support");
+  }
+  int level;
+  ZSTD_CCtx_getParameter(ctx, ZSTD_c_compressionLevel, &level);
+  if (level < params->min_level) {
+    level = params->min_level;
+  }
+  if (level > params->max_level) {
+    level = params->max_level;
+  }
+  ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, level);
+
+  sc->adapt = true;
+  sc->level = level;
+  sc->min_level = params->min_level;
+  sc->max_level = params->max_level;
+  reset_adapt_state(sc);
+}
+
 static VALUE
 rb_streaming_compress_initialize(int argc, VALUE *argv, VALUE obj)
 {
@@ -82,11 +217,22 @@ rb_streaming_compress_initialize(int argc, VALUE *argv, VALUE obj)
   TypedData_Get_Struct(obj, struct streaming_compress_t, &streaming_compress_type, sc);
   size_t const buffOutSize = ZSTD_CStreamOutSize();
 
-  ZSTD_CCtx* ctx = ZSTD_createCCtx();
+  ID adapt_keys[3];
+  adapt_keys[0] = rb_intern("adapt");
+  adapt_keys[1] = rb_intern("min_level");
+  adapt_keys[2] = rb_intern("max_level");
+  VALUE adapt_values[3];
+  /* the remaining keys are checked by set_compress_params */
+  rb_get_kwargs(kwargs, adapt_keys, 0, -4, adapt_values);
+  struct adapt_params adapt_params;
+  parse_adapt_params(&adapt_params, adapt_values[0], adapt_values[1], adapt_values[2]);
+
+  ZSTD_CCtx* ctx = zstd_ruby_create_cctx();
   if (ctx == NULL) {
     rb_raise(rb_eRuntimeError, "%s", "ZSTD_createCCtx error");
   }
   set_compress_params(ctx, kwargs);
+  set_adapt_params(sc, ctx, &adapt_params);
 
   sc->ctx = ctx;
   RB_OBJ_WRITE(obj, &sc->buf, rb_str_new(NULL, buffOutSize));
@@ -96,6 +242,26 @@ rb_streaming_compress_initialize(int argc, VALUE *argv, VALUE obj)
   return obj;
 }
 
+/*
+ * records whether the input had to wait for the workers, then samples the frame progression.
+ * A call that filled the output buffer may have stopped for lack of output space rather than
+ * for the workers, so it is not counted either way.
+ */
+static void
+count_input(struct streaming_compress_t* sc, const ZSTD_inBuffer* input, const ZSTD_outBuffer* output)
+{
+  if (!sc->adapt) {
+    return;
+  }
+  if (output->pos < output->size) {
+    sc->input_presented++;
+    if (input->pos < input->size) {
+      sc->input_blocked++;
+    }
+  }
+  adapt_compression_level(sc);
+}
+
 #define FIXNUMARG(val, ifnil) \
     (NIL_P((val)) ? (ifnil) \
     : (FIX2INT((val))))
@@ -116,13 +282,28 @@ no_compress(struct streaming_compress_t* sc, ZSTD_EndDirective endOp)
       rb_raise(rb_eRuntimeError, "flush error error code: %s", ZSTD_getErrorName(ret));
     }
     rb_str_cat(result, output.dst, output.pos);
+    sc->total_out += output.pos;
   } while (ret > 0);
+  if (endOp == ZSTD_e_flush) {
+    adapt_compression_level(sc);
+  }
   return result;
 }
 
+static VALUE rb_streaming_compress_compress(VALUE obj, VALUE src);
+
+static VALUE
+streaming_compress_compress_mapped(int argc, VALUE *argv, VALUE obj)
+{
+  return rb_streaming_compress_compress(obj, argv[0]);
+}
+
 static VALUE
 rb_streaming_compress_compress(VALUE obj, VALUE src)
 {
+  if (zstd_ruby_mappable_p(src)) {
+    return zstd_ruby_with_mapped_inputs(1, &src, obj, streaming_compress_compress_mapped);
+  }
   StringValue(src);
   const char* input_data = RSTRING_PTR(src);
   size_t input_size = RSTRING_LEN(src);
@@ -131,7 +312,13 @@ rb_streaming_compress_compress(VALUE obj, VALUE src)
   struct streaming_compress_t* sc;
   TypedData_Get_Struct(obj, struct streaming_compress_t, &streaming_compress_type, sc);
 
-  VALUE result = rb_str_new(0, 0);
+  /* bytes queued by write() or write_skippable_frame come first */
+  VALUE result = rb_str_dup(sc->pending);
+  rb_str_resize(sc->pending, 0);
+  if (input_size > 0) {
+    sc->in_frame = true;
+  }
+  sc->total_in += input_size;
   while (input.pos < input.size) {
     const char* output_data = RSTRING_PTR(sc->buf);
     ZSTD_outBuffer output = { (void*)output_data, sc->buf_size, 0 };
@@ -140,6 +327,8 @@ rb_streaming_compress_compress(VALUE obj, VALUE src)
       rb_raise(rb_eRuntimeError, "compress error error code: %s", ZSTD_getErrorName(ret));
     }
     rb_str_cat(result, output.dst, output.pos);
+    sc->total_out += output.pos;
+    count_input(sc, &input, &output);
   }
   return result;
 }
@@ -147,6 +336,11 @@ rb_streaming_compress_compress(VALUE obj, VALUE src)
 static VALUE
 rb_streaming_compress_write(int argc, VALUE *argv, VALUE obj)
 {
+  for (int i = 0; i < argc; i++) {
+    if (zstd_ruby_mappable_p(argv[i])) {
+      return zstd_ruby_with_mapped_inputs(argc, argv, obj, rb_streaming_compress_write);
+    }
+  }
   size_t total = 0;
   struct streaming_compress_t* sc;
   TypedData_Get_Struct(obj, struct streaming_compress_t, &streaming_compress_type, sc);
@@ -157,6 +351,9 @@ rb_streaming_compress_write(int argc, VALUE *argv, VALUE obj)
     const char* input_data = RSTRING_PTR(str);
     size_t input_size = RSTRING_LEN(str);
     ZSTD_inBuffer input = { input_data, input_size, 0 };
+    if (input_size > 0) {
+      sc->in_frame = true;
+    }
 
     while (input.pos < input.size) {
       const char* output_data = RSTRING_PTR(sc->buf);
@@ -165,12 +362,15 @@ rb_streaming_compress_write(int argc, VALUE *argv, VALUE obj)
       if (ZSTD_isError(ret)) {
         rb_raise(rb_eRuntimeError, "compress error error code: %s", ZSTD_getErrorName(ret));
       }
+      count_input(sc, &input, &output);
       /* Directly append to the pending buffer */
       if (output.pos > 0) {
         rb_str_cat(sc->pending, output.dst, output.pos);
+        sc->total_out += output.pos;
       }
     }
     total += RSTRING_LEN(str);
+    sc->total_in += input_size;
   }
 
   return SIZET2NUM(total);
@@ -218,9 +418,92 @@ rb_streaming_compress_finish(VALUE obj)
   VALUE out = rb_str_dup(sc->pending);
   rb_str_cat(out, RSTRING_PTR(drained), RSTRING_LEN(drained));
   rb_str_resize(sc->pending, 0);
+  sc->in_frame = false;
+  if (sc->adapt) {
+    reset_adapt_state(sc);
+  }
   return out;
 }
 
+static VALUE
+rb_streaming_compress_level(VALUE obj)
+{
+  struct streaming_compress_t* sc;
+  TypedData_Get_Struct(obj, struct streaming_compress_t, &streaming_compress_type, sc);
+  int level = sc->level;
+  if (!sc->adapt) {
+    ZSTD_CCtx_getParameter(sc->ctx, ZSTD_c_compressionLevel, &level);
+  }
+  return INT2NUM(level);
+}
+
+static VALUE
+rb_streaming_compress_write_skippable_frame(int argc, VALUE *argv, VALUE obj)
+{
+  VALUE skip_value;
+  VALUE kwargs;
+  rb_scan_args(argc, argv, "1:", &skip_value, &kwargs);
+
+  ID kwargs_keys[1];
+  kwargs_keys[0] = rb_intern("magic_variant");
+  VALUE kwargs_values[1];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 1, kwargs_values);
+  unsigned magic_variant = (kwargs_values[0] != Qundef) ? (NUM2INT(kwargs_values[0])) : 0;
+
+  StringValue(skip_value);
+  struct streaming_compress_t* sc;
+  TypedData_Get_Struct(obj, struct streaming_compress_t, &streaming_compress_type, sc);
+  if (sc->in_frame) {
+    rb_raise(rb_eRuntimeError, "%s", "skippable frame can only be written between frames, call finish first");
+  }
+
+  /* the skippable frame is appended to the pending output, before the next frame */
+  size_t const skip_size = RSTRING_LEN(skip_value);
+  size_t const dst_size = ZSTD_SKIPPABLEHEADERSIZE + skip_size;
+  size_t const pending_size = RSTRING_LEN(sc->pending);
+  rb_str_resize(sc->pending, pending_size + dst_size);
+  size_t const ret = ZSTD_writeSkippableFrame(RSTRING_PTR(sc->pending) + pending_size, dst_size, RSTRING_PTR(skip_value), skip_size, magic_variant);
+  if (ZSTD_isError(ret)) {
+    rb_str_resize(sc->pending, pending_size);
+    rb_raise(rb_eRuntimeError, "%s: %s", "write skippable frame failed", ZSTD_getErrorName(ret));
+  }
+  sc->total_out += dst_size;
+  return SIZET2NUM(dst_size);
+}
+
+static VALUE
+rb_streaming_compress_progress(VALUE obj)
+{
+  struct streaming_compress_t* sc;
+  TypedData_Get_Struct(obj, struct streaming_compress_t, &streaming_compress_type, sc);
+  ZSTD_frameProgression const progress = ZSTD_getFrameProgression(sc->ctx);
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, ID2SYM(rb_intern("ingested")), ULL2NUM(progress.ingested));
+  rb_hash_aset(result, ID2SYM(rb_intern("consumed")), ULL2NUM(progress.consumed));
+  rb_hash_aset(result, ID2SYM(rb_intern("produced")), ULL2NUM(progress.produced));
+  rb_hash_aset(result, ID2SYM(rb_intern("flushed")), ULL2NUM(progress.flushed));
+  rb_hash_aset(result, ID2SYM(rb_intern("current_job_id")), UINT2NUM(progress.currentJobID));
+  rb_hash_aset(result, ID2SYM(rb_intern("active_workers")), UINT2NUM(progress.nbActiveWorkers));
+  rb_hash_aset(result, ID2SYM(rb_intern("to_flush_now")), SIZET2NUM(ZSTD_toFlushNow(sc->ctx)));
+  return result;
+}
+
+static VALUE
+rb_streaming_compress_total_in(VALUE obj)
+{
+  struct streaming_compress_t* sc;
+  TypedData_Get_Struct(obj, struct streaming_compress_t, &streaming_compress_type, sc);
+  return ULL2NUM(sc->total_in);
+}
+
+static VALUE
+rb_streaming_compress_total_out(VALUE obj)
+{
+  struct streaming_compress_t* sc;
+  TypedData_Get_Struct(obj, struct streaming_compress_t, &streaming_compress_type, sc);
+  return ULL2NUM(sc->total_out);
+}
+
 extern VALUE rb_mZstd, cStreamingCompress;
 void
 zstd_ruby_streaming_compress_init(void)
@@ -237,6 +520,11 @@ zstd_ruby_streaming_compress_init(void)
 
   rb_define_method(cStreamingCompress, "flush", rb_streaming_compress_flush, 0);
   rb_define_method(cStreamingCompress, "finish", rb_streaming_compress_finish, 0);
+  rb_define_method(cStreamingCompress, "level", rb_streaming_compress_level, 0);
+  rb_define_method(cStreamingCompress, "progress", rb_streaming_compress_progress, 0);
+  rb_define_method(cStreamingCompress, "total_in", rb_streaming_compress_total_in, 0);
+  rb_define_method(cStreamingCompress, "total_out", rb_streaming_compress_total_out, 0);
+  rb_define_method(cStreamingCompress, "write_skippable_frame", rb_streaming_compress_write_skippable_frame, -1);
 
   rb_define_const(cStreamingCompress, "CONTINUE", INT2FIX(ZSTD_e_continue));
   rb_define_const(cStreamingCompress, "FLUSH", INT2FIX(ZSTD_e_flush));
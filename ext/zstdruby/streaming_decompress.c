@@ -4,6 +4,8 @@ struct streaming_decompress_t {
   ZSTD_DCtx* dctx;
   VALUE buf;
   size_t buf_size;
+  unsigned long long total_in;
+  unsigned long long total_out;
 };
 
 static void
@@ -31,7 +33,9 @@ streaming_decompress_free(void *p)
 static size_t
 streaming_decompress_memsize(const void *p)
 {
-    return sizeof(struct streaming_decompress_t);
+    const struct streaming_decompress_t *sd = p;
+    /* include the off-heap context so ObjectSpace.memsize_of reports it */
+    return sizeof(struct streaming_decompress_t) + (sd->dctx != NULL ? ZSTD_sizeof_DCtx(sd->dctx) : 0);
 }
 
 #ifdef HAVE_RB_GC_MARK_MOVABLE
@@ -64,6 +68,8 @@ rb_streaming_decompress_allocate(VALUE klass)
   sd->dctx = NULL;
   RB_OBJ_WRITE(obj, &sd->buf, Qnil);
   sd->buf_size = 0;
+  sd->total_in = 0;
+  sd->total_out = 0;
   return obj;
 }
 
@@ -77,7 +83,7 @@ rb_streaming_decompress_initialize(int argc, VALUE *argv, VALUE obj)
   TypedData_Get_Struct(obj, struct streaming_decompress_t, &streaming_decompress_type, sd);
   size_t const buffOutSize = ZSTD_DStreamOutSize();
 
-  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  ZSTD_DCtx* dctx = zstd_ruby_create_dctx();
   if (dctx == NULL) {
     rb_raise(rb_eRuntimeError, "%s", "ZSTD_createDCtx error");
   }
@@ -90,9 +96,20 @@ rb_streaming_decompress_initialize(int argc, VALUE *argv, VALUE obj)
   return obj;
 }
 
+static VALUE rb_streaming_decompress_decompress(VALUE obj, VALUE src);
+
+static VALUE
+streaming_decompress_decompress_mapped(int argc, VALUE *argv, VALUE obj)
+{
+  return rb_streaming_decompress_decompress(obj, argv[0]);
+}
+
 static VALUE
 rb_streaming_decompress_decompress(VALUE obj, VALUE src)
 {
+  if (zstd_ruby_mappable_p(src)) {
+    return zstd_ruby_with_mapped_inputs(1, &src, obj, streaming_decompress_decompress_mapped);
+  }
   StringValue(src);
   const char* input_data = RSTRING_PTR(src);
   size_t input_size = RSTRING_LEN(src);
@@ -113,16 +130,29 @@ rb_streaming_decompress_decompress(VALUE obj, VALUE src)
     if (output.pos > 0) {
         rb_str_cat(result, output.dst, output.pos);
     }
+    sd->total_out += output.pos;
     if (ret == 0 && output.pos == 0) {
         break;
     }
   }
+  sd->total_in += input.pos;
   return result;
 }
 
+static VALUE rb_streaming_decompress_decompress_with_pos(VALUE obj, VALUE src);
+
+static VALUE
+streaming_decompress_decompress_with_pos_mapped(int argc, VALUE *argv, VALUE obj)
+{
+  return rb_streaming_decompress_decompress_with_pos(obj, argv[0]);
+}
+
 static VALUE
 rb_streaming_decompress_decompress_with_pos(VALUE obj, VALUE src)
 {
+  if (zstd_ruby_mappable_p(src)) {
+    return zstd_ruby_with_mapped_inputs(1, &src, obj, streaming_decompress_decompress_with_pos_mapped);
+  }
   StringValue(src);
   const char* input_data = RSTRING_PTR(src);
   size_t input_size = RSTRING_LEN(src);
@@ -138,9 +168,27 @@ rb_streaming_decompress_decompress_with_pos(VALUE obj, VALUE src)
     rb_raise(rb_eRuntimeError, "decompress error error code: %s", ZSTD_getErrorName(ret));
   }
   rb_str_cat(result, output.dst, output.pos);
+  sd->total_in += input.pos;
+  sd->total_out += output.pos;
   return rb_ary_new_from_args(2, result, ULONG2NUM(input.pos));
 }
 
+static VALUE
+rb_streaming_decompress_total_in(VALUE obj)
+{
+  struct streaming_decompress_t* sd;
+  TypedData_Get_Struct(obj, struct streaming_decompress_t, &streaming_decompress_type, sd);
+  return ULL2NUM(sd->total_in);
+}
+
+static VALUE
+rb_streaming_decompress_total_out(VALUE obj)
+{
+  struct streaming_decompress_t* sd;
+  TypedData_Get_Struct(obj, struct streaming_decompress_t, &streaming_decompress_type, sd);
+  return ULL2NUM(sd->total_out);
+}
+
 extern VALUE rb_mZstd, cStreamingDecompress;
 void
 zstd_ruby_streaming_decompress_init(void)
@@ -150,4 +198,6 @@ zstd_ruby_streaming_decompress_init(void)
   rb_define_method(cStreamingDecompress, "initialize", rb_streaming_decompress_initialize, -1);
   rb_define_method(cStreamingDecompress, "decompress", rb_streaming_decompress_decompress, 1);
   rb_define_method(cStreamingDecompress, "decompress_with_pos", rb_streaming_decompress_decompress_with_pos, 1);
+  rb_define_method(cStreamingDecompress, "total_in", rb_streaming_decompress_total_in, 0);
+  rb_define_method(cStreamingDecompress, "total_out", rb_streaming_decompress_total_out, 0);
 }
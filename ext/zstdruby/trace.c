@@ -0,0 +1,388 @@
+#include "common.h"
+#include "threading.h"
+#include "./libzstd/common/zstd_trace.h"
+#include <time.h>
+
+extern VALUE rb_mZstd;
+
+/*
+ * libzstd calls ZSTD_trace_{compress,decompress}_{begin,end} around every frame, from whichever
+ * thread runs the (de)compression, usually without the GVL. The hooks aggregate counters per
+ * direction/level/dictionary and queue events for subscribers under a plain mutex. A dispatcher
+ * thread (lib/zstd-ruby/stats.rb) waits for the queue without the GVL and calls the subscribers
+ * as ordinary Ruby code. Events that do not fit in the queue are counted as dropped.
+ */
+
+#if ZSTD_TRACE
+
+#define TRACE_EVENTS_MAX 4096
+
+enum trace_kind { TRACE_COMPRESS, TRACE_DECOMPRESS };
+
+struct trace_stat {
+  enum trace_kind kind;
+  int level;
+  unsigned dict_id;
+  unsigned long long calls;
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  unsigned long long nanoseconds;
+};
+
+struct trace_event {
+  enum trace_kind kind;
+  int level;
+  unsigned dict_id;
+  int streaming;
+  size_t bytes_in;
+  size_t bytes_out;
+  unsigned long long nanoseconds;
+};
+
+static ZSTD_pthread_mutex_t trace_mutex;
+static ZSTD_pthread_cond_t trace_cond;
+static volatile int trace_enabled = 0;
+static volatile int trace_events_enabled = 0;
+static struct trace_stat* trace_stats = NULL;
+static size_t trace_stats_len = 0;
+static size_t trace_stats_capacity = 0;
+static struct trace_event trace_events[TRACE_EVENTS_MAX];
+static size_t trace_events_len = 0;
+static unsigned long long trace_events_dropped = 0;
+
+static unsigned long long trace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static ZSTD_TraceCtx trace_begin(void)
+{
+  if (!trace_enabled) {
+    return 0;
+  }
+  unsigned long long const now = trace_now();
+  return now ? now : 1;
+}
+
+/* called with trace_mutex held */
+static void trace_record(const struct trace_event* event)
+{
+  struct trace_stat* stat = NULL;
+  for (size_t i = 0; i < trace_stats_len; i++) {
+    if (trace_stats[i].kind == event->kind && trace_stats[i].level == event->level && trace_stats[i].dict_id == event->dict_id) {
+      stat = &trace_stats[i];
+      break;
+    }
+  }
+  if (stat == NULL) {
+    if (trace_stats_len == trace_stats_capacity) {
+      size_t const capacity = trace_stats_capacity ? trace_stats_capacity * 2 : 16;
+      struct trace_stat* stats = realloc(trace_stats, capacity * sizeof(struct trace_stat));
+      if (stats == NULL) {
+        return;
+      }
+      trace_stats = stats;
+      trace_stats_capacity = capacity;
+    }
+    stat = &trace_stats[trace_stats_len++];
+    memset(stat, 0, sizeof(*stat));
+    stat->kind = event->kind;
+    stat->level = event->level;
+    stat->dict_id = event->dict_id;
+  }
+  stat->calls++;
+  stat->bytes_in += event->bytes_in;
+  stat->bytes_out += event->bytes_out;
+  stat->nanoseconds += event->nanoseconds;
+}
+
+static void trace_end(const struct trace_event* event)
+{
+  ZSTD_pthread_mutex_lock(&trace_mutex);
+  trace_record(event);
+  if (trace_events_enabled) {
+    if (trace_events_len < TRACE_EVENTS_MAX) {
+      trace_events[trace_events_len++] = *event;
+      ZSTD_pthread_cond_signal(&trace_cond);
+    } else {
+      trace_events_dropped++;
+    }
+  }
+  ZSTD_pthread_mutex_unlock(&trace_mutex);
+}
+
+/* nothing calls the compression hooks in `--enable-decompress-only` builds */
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+ZSTD_TraceCtx ZSTD_trace_compress_begin(struct ZSTD_CCtx_s const* cctx)
+{
+  (void)cctx;
+  return trace_begin();
+}
+
+void ZSTD_trace_compress_end(ZSTD_TraceCtx ctx, ZSTD_Trace const* trace)
+{
+  int level = 0;
+  int workers = 0;
+  if (trace->version != ZSTD_VERSION_NUMBER) {
+    return;
+  }
+  ZSTD_CCtxParams_getParameter(trace->params, ZSTD_c_nbWorkers, &workers);
+  if (workers > 0) {
+    /* multi-threaded frames are accounted by their jobs, which run with nbWorkers = 0 */
+    return;
+  }
+  ZSTD_CCtxParams_getParameter(trace->params, ZSTD_c_compressionLevel, &level);
+  struct trace_event const event = {
+    TRACE_COMPRESS, level, trace->dictionaryID, trace->streaming,
+    trace->uncompressedSize, trace->compressedSize, trace_now() - ctx
+  };
+  trace_end(&event);
+}
+#endif
+
+ZSTD_TraceCtx ZSTD_trace_decompress_begin(struct ZSTD_DCtx_s const* dctx)
+{
+  (void)dctx;
+  return trace_begin();
+}
+
+void ZSTD_trace_decompress_end(ZSTD_TraceCtx ctx, ZSTD_Trace const* trace)
+{
+  if (trace->version != ZSTD_VERSION_NUMBER) {
+    return;
+  }
+  struct trace_event const event = {
+    TRACE_DECOMPRESS, 0, trace->dictionaryID, trace->streaming,
+    trace->compressedSize, trace->uncompressedSize, trace_now() - ctx
+  };
+  trace_end(&event);
+}
+
+#ifndef _WIN32
+/* the parent's threads, including a waiting dispatcher or a worker holding the mutex, do not exist in a forked child */
+static void trace_atfork_child(void)
+{
+  ZSTD_pthread_mutex_init(&trace_mutex, NULL);
+  ZSTD_pthread_cond_init(&trace_cond, NULL);
+  trace_events_len = 0;
+}
+#endif
+
+static VALUE trace_kind_name(enum trace_kind kind)
+{
+  return rb_str_new_cstr(kind == TRACE_COMPRESS ? "compress.zstd" : "decompress.zstd");
+}
+
+static VALUE trace_counters(enum trace_kind kind, int level, unsigned dict_id)
+{
+  VALUE hash = rb_hash_new();
+  if (kind == TRACE_COMPRESS) {
+    rb_hash_aset(hash, ID2SYM(rb_intern("level")), INT2NUM(level));
+  }
+  rb_hash_aset(hash, ID2SYM(rb_intern("dict_id")), UINT2NUM(dict_id));
+  return hash;
+}
+
+#ifdef HAVE_RUBY_THREAD_H
+struct trace_wait_t {
+  struct trace_event* events;
+  size_t len;
+  int interrupted;
+};
+
+static void* trace_wait_without_gvl(void* arg)
+{
+  struct trace_wait_t* wait = arg;
+  ZSTD_pthread_mutex_lock(&trace_mutex);
+  while (trace_events_len == 0 && !wait->interrupted) {
+    ZSTD_pthread_cond_wait(&trace_cond, &trace_mutex);
+  }
+  wait->events = malloc(trace_events_len * sizeof(struct trace_event) + 1);
+  if (wait->events != NULL) {
+    memcpy(wait->events, trace_events, trace_events_len * sizeof(struct trace_event));
+    wait->len = trace_events_len;
+  } else {
+    trace_events_dropped += trace_events_len;
+  }
+  trace_events_len = 0;
+  ZSTD_pthread_mutex_unlock(&trace_mutex);
+  return NULL;
+}
+
+static void trace_wait_ubf(void* arg)
+{
+  struct trace_wait_t* wait = arg;
+  ZSTD_pthread_mutex_lock(&trace_mutex);
+  wait->interrupted = 1;
+  ZSTD_pthread_cond_broadcast(&trace_cond);
+  ZSTD_pthread_mutex_unlock(&trace_mutex);
+}
+
+/* blocks until events are queued and returns them as [name, payload] pairs; empty when interrupted */
+static VALUE rb_wait_trace_events(VALUE self)
+{
+  struct trace_wait_t wait = { NULL, 0, 0 };
+  rb_thread_call_without_gvl(trace_wait_without_gvl, &wait, trace_wait_ubf, &wait);
+
+  VALUE ary = rb_ary_new_capa(wait.len);
+  for (size_t i = 0; i < wait.len; i++) {
+    const struct trace_event* const event = &wait.events[i];
+    VALUE payload = trace_counters(event->kind, event->level, event->dict_id);
+    rb_hash_aset(payload, ID2SYM(rb_intern("streaming")), event->streaming ? Qtrue : Qfalse);
+    rb_hash_aset(payload, ID2SYM(rb_intern("bytes_in")), SIZET2NUM(event->bytes_in));
+    rb_hash_aset(payload, ID2SYM(rb_intern("bytes_out")), SIZET2NUM(event->bytes_out));
+    rb_hash_aset(payload, ID2SYM(rb_intern("nanoseconds")), ULL2NUM(event->nanoseconds));
+    rb_ary_push(ary, rb_assoc_new(trace_kind_name(event->kind), payload));
+  }
+  free(wait.events);
+  return ary;
+}
+#endif
+
+static VALUE rb_trace_supported_p(VALUE self)
+{
+  return Qtrue;
+}
+
+static VALUE rb_trace_events_supported_p(VALUE self)
+{
+#ifdef HAVE_RUBY_THREAD_H
+  return Qtrue;
+#else
+  return Qfalse;
+#endif
+}
+
+static VALUE rb_stats_enabled_p(VALUE self)
+{
+  return trace_enabled ? Qtrue : Qfalse;
+}
+
+static VALUE rb_set_stats_enabled(VALUE self, VALUE enabled)
+{
+  trace_enabled = RTEST(enabled);
+  return enabled;
+}
+
+static VALUE rb_set_trace_events(VALUE self, VALUE enabled)
+{
+#ifdef HAVE_RUBY_THREAD_H
+  ZSTD_pthread_mutex_lock(&trace_mutex);
+  trace_events_enabled = RTEST(enabled);
+  if (!trace_events_enabled) {
+    trace_events_len = 0;
+  }
+  ZSTD_pthread_mutex_unlock(&trace_mutex);
+  return enabled;
+#else
+  rb_raise(rb_eNotImpError, "%s", "trace subscribers require native threads");
+#endif
+}
+
+static VALUE rb_stats(VALUE self)
+{
+  struct trace_stat* stats;
+  size_t len;
+  unsigned long long dropped;
+
+  ZSTD_pthread_mutex_lock(&trace_mutex);
+  len = trace_stats_len;
+  stats = malloc(len * sizeof(struct trace_stat) + 1);
+  if (stats == NULL) {
+    ZSTD_pthread_mutex_unlock(&trace_mutex);
+    rb_raise(rb_eNoMemError, "%s", "failed to allocate stats");
+  }
+  memcpy(stats, trace_stats, len * sizeof(struct trace_stat));
+  dropped = trace_events_dropped;
+  ZSTD_pthread_mutex_unlock(&trace_mutex);
+
+  VALUE compress = rb_ary_new();
+  VALUE decompress = rb_ary_new();
+  for (size_t i = 0; i < len; i++) {
+    VALUE counters = trace_counters(stats[i].kind, stats[i].level, stats[i].dict_id);
+    rb_hash_aset(counters, ID2SYM(rb_intern("calls")), ULL2NUM(stats[i].calls));
+    rb_hash_aset(counters, ID2SYM(rb_intern("bytes_in")), ULL2NUM(stats[i].bytes_in));
+    rb_hash_aset(counters, ID2SYM(rb_intern("bytes_out")), ULL2NUM(stats[i].bytes_out));
+    rb_hash_aset(counters, ID2SYM(rb_intern("nanoseconds")), ULL2NUM(stats[i].nanoseconds));
+    rb_ary_push(stats[i].kind == TRACE_COMPRESS ? compress : decompress, counters);
+  }
+  free(stats);
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, ID2SYM(rb_intern("compress")), compress);
+  rb_hash_aset(result, ID2SYM(rb_intern("decompress")), decompress);
+  rb_hash_aset(result, ID2SYM(rb_intern("dropped_events")), ULL2NUM(dropped));
+  return result;
+}
+
+static VALUE rb_reset_stats(VALUE self)
+{
+  ZSTD_pthread_mutex_lock(&trace_mutex);
+  trace_stats_len = 0;
+  trace_events_dropped = 0;
+  ZSTD_pthread_mutex_unlock(&trace_mutex);
+  return Qnil;
+}
+
+#else /* !ZSTD_TRACE */
+
+static VALUE rb_trace_supported_p(VALUE self)
+{
+  return Qfalse;
+}
+
+static VALUE rb_trace_events_supported_p(VALUE self)
+{
+  return Qfalse;
+}
+
+static VALUE rb_stats_enabled_p(VALUE self)
+{
+  return Qfalse;
+}
+
+static VALUE rb_set_stats_enabled(VALUE self, VALUE enabled)
+{
+  rb_raise(rb_eNotImpError, "%s", "libzstd was built without trace support");
+}
+
+static VALUE rb_set_trace_events(VALUE self, VALUE enabled)
+{
+  rb_raise(rb_eNotImpError, "%s", "libzstd was built without trace support");
+}
+
+static VALUE rb_stats(VALUE self)
+{
+  rb_raise(rb_eNotImpError, "%s", "libzstd was built without trace support");
+}
+
+static VALUE rb_reset_stats(VALUE self)
+{
+  rb_raise(rb_eNotImpError, "%s", "libzstd was built without trace support");
+}
+
+#endif /* ZSTD_TRACE */
+
+void
+zstd_ruby_trace_init(void)
+{
+#if ZSTD_TRACE
+  ZSTD_pthread_mutex_init(&trace_mutex, NULL);
+  ZSTD_pthread_cond_init(&trace_cond, NULL);
+#ifndef _WIN32
+  pthread_atfork(NULL, NULL, trace_atfork_child);
+#endif
+#ifdef HAVE_RUBY_THREAD_H
+  rb_define_private_method(rb_singleton_class(rb_mZstd), "wait_trace_events", rb_wait_trace_events, 0);
+#endif
+#endif
+  rb_define_module_function(rb_mZstd, "stats_supported?", rb_trace_supported_p, 0);
+  rb_define_module_function(rb_mZstd, "stats_enabled?", rb_stats_enabled_p, 0);
+  rb_define_module_function(rb_mZstd, "stats_enabled=", rb_set_stats_enabled, 1);
+  rb_define_module_function(rb_mZstd, "stats", rb_stats, 0);
+  rb_define_module_function(rb_mZstd, "reset_stats", rb_reset_stats, 0);
+  rb_define_module_function(rb_mZstd, "trace_events_supported?", rb_trace_events_supported_p, 0);
+  rb_define_private_method(rb_singleton_class(rb_mZstd), "trace_events=", rb_set_trace_events, 1);
+}
@@ -0,0 +1,233 @@
+#include "common.h"
+#define XXH_STATIC_LINKING_ONLY /* XXH64_state_t is embedded in objects */
+#include "xxhash.h"
+
+extern VALUE rb_mZstd;
+
+/*
+ * Zstd::XXH64 exposes the XXH64 implementation libzstd uses for frame checksums
+ * (libzstd/common/xxhash.c, built with XXH_NO_XXH3, so XXH3 is not available).
+ */
+
+#define XXH64_NOGVL_THRESHOLD (64 * 1024) /* inputs from this size are hashed without the GVL */
+#define HASHED_CHUNK_SIZE (128 * 1024)    /* one block: hashed while it is still in cache, then compressed */
+
+struct xxh64_t {
+  XXH64_state_t state;
+  unsigned long long seed;
+};
+
+static size_t
+xxh64_memsize(const void* p)
+{
+  return sizeof(struct xxh64_t);
+}
+
+static const rb_data_type_t xxh64_type = {
+  "Zstd::XXH64",
+  { NULL, RUBY_TYPED_DEFAULT_FREE, xxh64_memsize, },
+  0, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+struct xxh64_update_t {
+  XXH64_state_t* state;
+  const char* data;
+  size_t size;
+};
+
+static void*
+xxh64_update_without_gvl(void* arg)
+{
+  struct xxh64_update_t* update = arg;
+  XXH64_update(update->state, update->data, update->size);
+  return NULL;
+}
+
+static void
+xxh64_update(XXH64_state_t* state, const char* data, size_t size)
+{
+  struct xxh64_update_t update = { state, data, size };
+#ifdef HAVE_RUBY_THREAD_H
+  if (size >= XXH64_NOGVL_THRESHOLD) {
+    rb_thread_call_without_gvl(xxh64_update_without_gvl, &update, NULL, NULL);
+    return;
+  }
+#endif
+  xxh64_update_without_gvl(&update);
+}
+
+unsigned long long
+zstd_ruby_xxh64(const char* data, size_t size)
+{
+  XXH64_state_t state;
+  XXH64_reset(&state, 0);
+  xxh64_update(&state, data, size);
+  return XXH64_digest(&state);
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+struct compress_hashed_t {
+  ZSTD_CCtx* ctx;
+  char* dst;
+  size_t dst_size;
+  const char* src;
+  size_t src_size;
+  XXH64_state_t state;
+  size_t ret;
+};
+
+/*
+ * Compresses from a stable input buffer that grows by one chunk at a time, and hashes each chunk
+ * right before libzstd reads it, so the input is read from memory once. The frame is the same as
+ * ZSTD_compress2 writes: the content size is pledged and nothing is copied into the window buffer.
+ */
+static void*
+compress_hashed_without_gvl(void* arg)
+{
+  struct compress_hashed_t* job = arg;
+  ZSTD_inBuffer in = { job->src, 0, 0 };
+  ZSTD_outBuffer out = { job->dst, job->dst_size, 0 };
+  for (;;) {
+    size_t const chunk = job->src_size - in.size < HASHED_CHUNK_SIZE ? job->src_size - in.size : HASHED_CHUNK_SIZE;
+    XXH64_update(&job->state, job->src + in.size, chunk);
+    in.size += chunk;
+    ZSTD_EndDirective const mode = in.size == job->src_size ? ZSTD_e_end : ZSTD_e_continue;
+    do {
+      job->ret = ZSTD_compressStream2(job->ctx, &out, &in, mode);
+      if (ZSTD_isError(job->ret)) {
+        return NULL;
+      }
+    } while (mode == ZSTD_e_end ? job->ret != 0 : in.pos < in.size && out.pos < out.size);
+    if (mode == ZSTD_e_end) {
+      job->ret = out.pos;
+      return NULL;
+    }
+  }
+}
+
+size_t
+zstd_ruby_compress_hashed(ZSTD_CCtx* ctx, char* dst, size_t dst_size, const char* src, size_t src_size, unsigned long long* hash)
+{
+  struct compress_hashed_t job = { ctx, dst, dst_size, src, src_size };
+  XXH64_reset(&job.state, 0);
+  ZSTD_CCtx_setParameter(ctx, ZSTD_c_stableInBuffer, 1);
+  ZSTD_CCtx_setParameter(ctx, ZSTD_c_stableOutBuffer, 1);
+  ZSTD_CCtx_setPledgedSrcSize(ctx, src_size);
+#ifdef HAVE_RUBY_THREAD_H
+  rb_thread_call_without_gvl(compress_hashed_without_gvl, &job, NULL, NULL);
+#else
+  compress_hashed_without_gvl(&job);
+#endif
+  *hash = XXH64_digest(&job.state);
+  return job.ret;
+}
+#endif
+
+static VALUE
+rb_xxh64_alloc(VALUE klass)
+{
+  struct xxh64_t* xxh;
+  VALUE obj = TypedData_Make_Struct(klass, struct xxh64_t, &xxh64_type, xxh);
+  XXH64_reset(&xxh->state, 0);
+  return obj;
+}
+
+static unsigned long long
+convert_seed(VALUE seed_value)
+{
+  return NIL_P(seed_value) ? 0 : NUM2ULL(seed_value);
+}
+
+static VALUE
+rb_xxh64_initialize(int argc, VALUE *argv, VALUE self)
+{
+  VALUE seed_value;
+  rb_scan_args(argc, argv, "01", &seed_value);
+  struct xxh64_t* xxh;
+  TypedData_Get_Struct(self, struct xxh64_t, &xxh64_type, xxh);
+  xxh->seed = convert_seed(seed_value);
+  XXH64_reset(&xxh->state, xxh->seed);
+  return self;
+}
+
+static VALUE
+rb_xxh64_update(VALUE self, VALUE data);
+
+static VALUE
+xxh64_update_mapped(int argc, VALUE *argv, VALUE self)
+{
+  return rb_xxh64_update(self, argv[0]);
+}
+
+static VALUE
+rb_xxh64_update(VALUE self, VALUE data)
+{
+  if (zstd_ruby_mappable_p(data)) {
+    return zstd_ruby_with_mapped_inputs(1, &data, self, xxh64_update_mapped);
+  }
+  StringValue(data);
+  struct xxh64_t* xxh;
+  TypedData_Get_Struct(self, struct xxh64_t, &xxh64_type, xxh);
+  xxh64_update(&xxh->state, RSTRING_PTR(data), RSTRING_LEN(data));
+  RB_GC_GUARD(data);
+  return self;
+}
+
+static VALUE
+rb_xxh64_digest(VALUE self)
+{
+  struct xxh64_t* xxh;
+  TypedData_Get_Struct(self, struct xxh64_t, &xxh64_type, xxh);
+  return ULL2NUM(XXH64_digest(&xxh->state));
+}
+
+static VALUE
+rb_xxh64_reset(VALUE self)
+{
+  struct xxh64_t* xxh;
+  TypedData_Get_Struct(self, struct xxh64_t, &xxh64_type, xxh);
+  XXH64_reset(&xxh->state, xxh->seed);
+  return self;
+}
+
+static VALUE
+rb_xxh64_initialize_copy(VALUE self, VALUE other)
+{
+  struct xxh64_t* xxh;
+  struct xxh64_t* other_xxh;
+  TypedData_Get_Struct(self, struct xxh64_t, &xxh64_type, xxh);
+  TypedData_Get_Struct(other, struct xxh64_t, &xxh64_type, other_xxh);
+  *xxh = *other_xxh;
+  return self;
+}
+
+/* Zstd::XXH64.digest(data, seed = 0) */
+static VALUE
+rb_xxh64_s_digest(int argc, VALUE *argv, VALUE klass)
+{
+  VALUE data, seed_value;
+  rb_scan_args(argc, argv, "11", &data, &seed_value);
+  if (zstd_ruby_mappable_p(data)) {
+    return zstd_ruby_with_mapped_inputs(argc, argv, klass, rb_xxh64_s_digest);
+  }
+  StringValue(data);
+  XXH64_state_t state;
+  XXH64_reset(&state, convert_seed(seed_value));
+  xxh64_update(&state, RSTRING_PTR(data), RSTRING_LEN(data));
+  RB_GC_GUARD(data);
+  return ULL2NUM(XXH64_digest(&state));
+}
+
+void
+zstd_ruby_xxh64_init(void)
+{
+  VALUE cXXH64 = rb_define_class_under(rb_mZstd, "XXH64", rb_cObject);
+  rb_define_alloc_func(cXXH64, rb_xxh64_alloc);
+  rb_define_singleton_method(cXXH64, "digest", rb_xxh64_s_digest, -1);
+  rb_define_method(cXXH64, "initialize", rb_xxh64_initialize, -1);
+  rb_define_method(cXXH64, "initialize_copy", rb_xxh64_initialize_copy, 1);
+  rb_define_method(cXXH64, "update", rb_xxh64_update, 1);
+  rb_define_method(cXXH64, "<<", rb_xxh64_update, 1);
+  rb_define_method(cXXH64, "digest", rb_xxh64_digest, 0);
+  rb_define_method(cXXH64, "reset", rb_xxh64_reset, 0);
+}
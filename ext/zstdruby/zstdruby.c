@@ -1,6 +1,24 @@
 #include <common.h>
+#include "ruby/io.h"
+#ifdef USE_SYSTEM_ZSTD
+#include <zdict.h>
+#elif defined(ZSTD_RUBY_NO_DICT_BUILDER)
+#include "./libzstd/decompress/zstd_decompress_internal.h"
+#else
+#include "./libzstd/zdict.h"
+#endif
 
 extern VALUE rb_mZstd;
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+VALUE zstd_compress_frames(VALUE input_value, const struct compress_options* options, int threads, size_t frame_size, bool seek_table, VALUE metadata, unsigned magic_variant);
+#endif
+VALUE zstd_decompress_frames(VALUE input_value, const struct decompress_options* options, int threads);
+unsigned long long zstd_ruby_xxh64(const char* data, size_t size);
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+size_t zstd_ruby_compress_hashed(ZSTD_CCtx* ctx, char* dst, size_t dst_size, const char* src, size_t src_size, unsigned long long* hash);
+#endif
+
+#define DEFAULT_PARALLEL_FRAME_SIZE (4 * 1024 * 1024)
 
 static VALUE zstdVersion(VALUE self)
 {
@@ -8,52 +26,120 @@ static VALUE zstdVersion(VALUE self)
   return INT2NUM(version);
 }
 
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
 static VALUE rb_compress(int argc, VALUE *argv, VALUE self)
 {
+  if (argc > 0 && zstd_ruby_mappable_p(argv[0])) {
+    return zstd_ruby_with_mapped_inputs(argc, argv, self, rb_compress);
+  }
   VALUE input_value;
   VALUE kwargs;
   rb_scan_args(argc, argv, "10:", &input_value, &kwargs);
 
+  ID kwargs_keys[9];
+  kwargs_keys[0] = rb_intern("level");
+  kwargs_keys[1] = rb_intern("dict");
+  kwargs_keys[2] = rb_intern("parallel");
+  kwargs_keys[3] = rb_intern("frame_size");
+  kwargs_keys[4] = rb_intern("seek_table");
+  kwargs_keys[5] = rb_intern("metadata");
+  kwargs_keys[6] = rb_intern("magic_variant");
+  kwargs_keys[7] = rb_intern("checksum");
+  kwargs_keys[8] = rb_intern("hash");
+  VALUE kwargs_values[9];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 9, kwargs_values);
+
   StringValue(input_value);
+  struct compress_options options = { kwargs_values[0], kwargs_values[1], kwargs_values[7] };
+  /* `hash: true` returns [compressed, XXH64 of the input] */
+  bool const hash = kwargs_values[8] != Qundef && RTEST(kwargs_values[8]);
+
+  bool const seek_table = kwargs_values[4] != Qundef && RTEST(kwargs_values[4]);
+
+  /* metadata is written as a skippable frame in front of the compressed data */
+  VALUE metadata = Qnil;
+  unsigned magic_variant = 0;
+  if (kwargs_values[5] != Qundef && kwargs_values[5] != Qnil) {
+    metadata = kwargs_values[5];
+    StringValue(metadata);
+    if (kwargs_values[6] != Qundef && kwargs_values[6] != Qnil) {
+      magic_variant = NUM2UINT(kwargs_values[6]);
+    }
+    if (seek_table) {
+      rb_raise(rb_eArgError, "`metadata:` cannot be used with `seek_table:`");
+    }
+  }
+
+  if ((kwargs_values[2] != Qundef && kwargs_values[2] != Qnil) ||
+      (kwargs_values[3] != Qundef && kwargs_values[3] != Qnil) || seek_table) {
+    int threads = 1;
+    size_t frame_size = DEFAULT_PARALLEL_FRAME_SIZE;
+    if (kwargs_values[2] != Qundef && kwargs_values[2] != Qnil) {
+      threads = NUM2INT(kwargs_values[2]);
+      if (threads < 1) {
+        rb_raise(rb_eArgError, "`parallel:` must be a positive Integer");
+      }
+    }
+    if (kwargs_values[3] != Qundef && kwargs_values[3] != Qnil) {
+      frame_size = NUM2SIZET(kwargs_values[3]);
+    }
+    VALUE output = zstd_compress_frames(input_value, &options, threads, frame_size, seek_table, metadata, magic_variant);
+    if (hash) {
+      return rb_assoc_new(output, ULL2NUM(zstd_ruby_xxh64(RSTRING_PTR(input_value), RSTRING_LEN(input_value))));
+    }
+    return output;
+  }
 
-  ZSTD_CCtx* const ctx = ZSTD_createCCtx();
+  ZSTD_CCtx* const ctx = zstd_ruby_acquire_cctx();
   if (ctx == NULL) {
     rb_raise(rb_eRuntimeError, "%s", "ZSTD_createCCtx error");
   }
 
-  set_compress_params(ctx, kwargs);
+  set_compress_options(ctx, &options);
 
   char* input_data = RSTRING_PTR(input_value);
   size_t input_size = RSTRING_LEN(input_value);
 
   size_t max_compressed_size = ZSTD_compressBound(input_size);
-  VALUE output = rb_str_new(NULL, max_compressed_size);
+  size_t skippable_size = NIL_P(metadata) ? 0 : ZSTD_SKIPPABLEHEADERSIZE + RSTRING_LEN(metadata);
+  VALUE output = rb_str_new(NULL, skippable_size + max_compressed_size);
   char* output_data = RSTRING_PTR(output);
 
-  size_t const ret = zstd_compress(ctx, output_data, max_compressed_size, input_data, input_size, false);
-  ZSTD_freeCCtx(ctx);
+  if (!NIL_P(metadata)) {
+    size_t const skippable_ret = ZSTD_writeSkippableFrame(output_data, skippable_size, RSTRING_PTR(metadata), RSTRING_LEN(metadata), magic_variant);
+    if (ZSTD_isError(skippable_ret)) {
+      ZSTD_freeCCtx(ctx);
+      rb_raise(rb_eRuntimeError, "%s: %s", "write skippable frame failed", ZSTD_getErrorName(skippable_ret));
+    }
+  }
+
+  unsigned long long digest = 0;
+  size_t const ret = hash
+    ? zstd_ruby_compress_hashed(ctx, output_data + skippable_size, max_compressed_size, input_data, input_size, &digest)
+    : zstd_compress(ctx, output_data + skippable_size, max_compressed_size, input_data, input_size, false);
+  zstd_ruby_release_cctx(ctx);
   if (ZSTD_isError(ret)) {
     rb_raise(rb_eRuntimeError, "compress error error code: %s", ZSTD_getErrorName(ret));
   }
-  rb_str_resize(output, ret);
+  rb_str_resize(output, skippable_size + ret);
 
-  return output;
+  return hash ? rb_assoc_new(output, ULL2NUM(digest)) : output;
 }
+#endif
 
-static VALUE decode_one_frame(ZSTD_DCtx* dctx, const unsigned char* src, size_t size, VALUE kwargs) {
-  VALUE out = rb_str_buf_new(0);
+static size_t decode_one_frame(ZSTD_DCtx* dctx, const unsigned char* src, size_t size, VALUE out) {
   size_t cap = ZSTD_DStreamOutSize();
   char *buf = ALLOC_N(char, cap);
   ZSTD_inBuffer in = (ZSTD_inBuffer){ src, size, 0 };
 
   ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
-  set_decompress_params(dctx, kwargs);
 
   for (;;) {
     ZSTD_outBuffer o = (ZSTD_outBuffer){ buf, cap, 0 };
     size_t ret = ZSTD_decompressStream(dctx, &o, &in);
     if (ZSTD_isError(ret)) {
       xfree(buf);
+      ZSTD_freeDCtx(dctx);
       rb_raise(rb_eRuntimeError, "ZSTD_decompressStream failed: %s", ZSTD_getErrorName(ret));
     }
     if (o.pos) {
@@ -62,20 +148,64 @@ static VALUE decode_one_frame(ZSTD_DCtx* dctx, const unsigned char* src, size_t
     if (ret == 0) {
       break;
     }
+    if (in.pos == in.size && o.pos < o.size) {
+      xfree(buf);
+      ZSTD_freeDCtx(dctx);
+      rb_raise(rb_eRuntimeError, "ZSTD_decompressStream failed: %s", "truncated frame");
+    }
   }
   xfree(buf);
-  return out;
+  return in.pos;
 }
 
 static VALUE decompress_buffered(ZSTD_DCtx* dctx, const char* data, size_t len) {
-  return decode_one_frame(dctx, (const unsigned char*)data, len, Qnil);
+  VALUE out = rb_str_buf_new(0);
+  decode_one_frame(dctx, (const unsigned char*)data, len, out);
+  return out;
 }
 
 static VALUE rb_decompress(int argc, VALUE *argv, VALUE self)
 {
+  if (argc > 0 && zstd_ruby_mappable_p(argv[0])) {
+    return zstd_ruby_with_mapped_inputs(argc, argv, self, rb_decompress);
+  }
   VALUE input_value, kwargs;
   rb_scan_args(argc, argv, "10:", &input_value, &kwargs);
+
+  ID kwargs_keys[4];
+  kwargs_keys[0] = rb_intern("dict");
+  kwargs_keys[1] = rb_intern("verify_checksum");
+  kwargs_keys[2] = rb_intern("parallel");
+  kwargs_keys[3] = rb_intern("output");
+  VALUE kwargs_values[4];
+  rb_get_kwargs(kwargs, kwargs_keys, 0, 4, kwargs_values);
+
   StringValue(input_value);
+  struct decompress_options options = { kwargs_values[0], kwargs_values[1] };
+
+  /* decompress straight into a File, returning the number of bytes written */
+  if (kwargs_values[3] != Qundef && kwargs_values[3] != Qnil) {
+    VALUE output = rb_io_get_io(kwargs_values[3]);
+    ZSTD_DCtx* const dctx = zstd_ruby_create_dctx();
+    if (dctx == NULL) {
+      rb_raise(rb_eRuntimeError, "ZSTD_createDCtx failed");
+    }
+    set_decompress_options(dctx, &options);
+    VALUE written = zstd_ruby_decompress_to_file(dctx, RSTRING_PTR(input_value), RSTRING_LEN(input_value), output);
+    RB_GC_GUARD(input_value);
+    return written;
+  }
+
+  if (kwargs_values[2] != Qundef && kwargs_values[2] != Qnil) {
+    int threads = NUM2INT(kwargs_values[2]);
+    if (threads < 1) {
+      rb_raise(rb_eArgError, "`parallel:` must be a positive Integer");
+    }
+    VALUE out = zstd_decompress_frames(input_value, &options, threads);
+    if (!NIL_P(out)) {
+      return out;
+    }
+  }
 
   size_t in_size = RSTRING_LEN(input_value);
   const unsigned char *in = (const unsigned char *)RSTRING_PTR(input_value);
@@ -83,6 +213,8 @@ static VALUE rb_decompress(int argc, VALUE *argv, VALUE self)
   size_t off = 0;
   const uint32_t ZSTD_MAGIC = 0xFD2FB528U;
   const uint32_t SKIP_LO    = 0x184D2A50U; /* ...5F */
+  ZSTD_DCtx *dctx = NULL;
+  VALUE out = Qnil;
 
   while (off + 4 <= in_size) {
     uint32_t magic = (uint32_t)in[off]
@@ -103,25 +235,34 @@ static VALUE rb_decompress(int argc, VALUE *argv, VALUE self)
     }
 
     if (magic == ZSTD_MAGIC) {
-      ZSTD_DCtx *dctx = ZSTD_createDCtx();
-      if (!dctx) {
-        rb_raise(rb_eRuntimeError, "ZSTD_createDCtx failed");
+      if (dctx == NULL) {
+        dctx = zstd_ruby_acquire_dctx();
+        if (!dctx) {
+          rb_raise(rb_eRuntimeError, "ZSTD_createDCtx failed");
+        }
+        set_decompress_options(dctx, &options);
+        out = rb_str_buf_new(0);
       }
 
-      VALUE out = decode_one_frame(dctx, in + off, in_size - off, kwargs);
-
-      ZSTD_freeDCtx(dctx);
-      RB_GC_GUARD(input_value);
-      return out;
+      /* concatenated frames are decoded one after another, like the zstd CLI does */
+      off += decode_one_frame(dctx, in + off, in_size - off, out);
+      continue;
     }
 
+    /* once a frame has been decoded, stop at anything that is not another frame */
+    if (dctx != NULL) break;
     off += 1;
   }
 
   RB_GC_GUARD(input_value);
+  if (dctx != NULL) {
+    zstd_ruby_release_dctx(dctx);
+    return out;
+  }
   rb_raise(rb_eRuntimeError, "not a zstd frame (magic not found)");
 }
 
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
 static void free_cdict(void *dict)
 {
   ZSTD_freeCDict(dict);
@@ -131,6 +272,7 @@ static size_t sizeof_cdict(const void *dict)
 {
   return ZSTD_sizeof_CDict(dict);
 }
+#endif
 
 static void free_ddict(void *dict)
 {
@@ -142,18 +284,63 @@ static size_t sizeof_ddict(const void *dict)
   return ZSTD_sizeof_DDict(dict);
 }
 
+/* dictionaries are read-only once created and frozen by initialize, so they can be shared between Ractors */
+#ifdef RUBY_TYPED_FROZEN_SHAREABLE
+#define DICT_TYPED_FLAGS (RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED | RUBY_TYPED_FROZEN_SHAREABLE)
+#else
+#define DICT_TYPED_FLAGS (RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED)
+#endif
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
 static const rb_data_type_t cdict_type = {
   "Zstd::CDict",
   {0, free_cdict, sizeof_cdict,},
-  0, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+  0, 0, DICT_TYPED_FLAGS
 };
+#endif
 
 static const rb_data_type_t ddict_type = {
   "Zstd::DDict",
   {0, free_ddict, sizeof_ddict,},
-  0, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+  0, 0, DICT_TYPED_FLAGS
 };
 
+#ifdef ZSTD_RUBY_NO_DICT_BUILDER
+/* without the dictionary builder, the header is measured by loading its entropy tables for decompression */
+static size_t dict_header_size(const char* dict_buffer, size_t dict_size)
+{
+  ZSTD_entropyDTables_t* const entropy = malloc(sizeof(ZSTD_entropyDTables_t));
+  if (entropy == NULL) {
+    return ERROR(memory_allocation);
+  }
+  entropy->hufTable[0] = (HUF_DTable)((ZSTD_HUFFDTABLE_CAPACITY_LOG)*0x1000001); /* as ZSTD_createDDict does */
+  size_t const header_size = ZSTD_loadDEntropy(entropy, dict_buffer, dict_size);
+  free(entropy);
+  return header_size;
+}
+#else
+#define dict_header_size ZDICT_getDictHeaderSize
+#endif
+
+static void set_dict_info(VALUE self, const char* dict_buffer, size_t dict_size)
+{
+  size_t header_size = 0;
+  ID content_type = rb_intern("raw");
+  const unsigned char* p = (const unsigned char*)dict_buffer;
+  if (dict_size >= 8 &&
+      ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)) == ZSTD_MAGIC_DICTIONARY) {
+    header_size = dict_header_size(dict_buffer, dict_size);
+    if (ZSTD_isError(header_size)) {
+      rb_raise(rb_eArgError, "invalid dictionary: %s", ZSTD_getErrorName(header_size));
+    }
+    content_type = rb_intern("full");
+  }
+  rb_iv_set(self, "@size", SIZET2NUM(dict_size));
+  rb_iv_set(self, "@header_size", SIZET2NUM(header_size));
+  rb_iv_set(self, "@content_type", ID2SYM(content_type));
+}
+
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
 static VALUE rb_cdict_alloc(VALUE self)
 {
   ZSTD_CDict* cdict = NULL;
@@ -170,6 +357,7 @@ static VALUE rb_cdict_initialize(int argc, VALUE *argv, VALUE self)
   StringValue(dict);
   char* dict_buffer = RSTRING_PTR(dict);
   size_t dict_size = RSTRING_LEN(dict);
+  set_dict_info(self, dict_buffer, dict_size);
 
   ZSTD_CDict* const cdict = ZSTD_createCDict(dict_buffer, dict_size, compression_level);
   if (cdict == NULL) {
@@ -177,8 +365,11 @@ static VALUE rb_cdict_initialize(int argc, VALUE *argv, VALUE self)
   }
 
   DATA_PTR(self) = cdict;
+  rb_iv_set(self, "@compression_level", INT2NUM(compression_level));
+  rb_obj_freeze(self);
   return self;
 }
+#endif
 
 static VALUE rb_ddict_alloc(VALUE self)
 {
@@ -191,16 +382,79 @@ static VALUE rb_ddict_initialize(VALUE self, VALUE dict)
   StringValue(dict);
   char* dict_buffer = RSTRING_PTR(dict);
   size_t dict_size = RSTRING_LEN(dict);
+  set_dict_info(self, dict_buffer, dict_size);
 
-  ZSTD_DDict* const ddict = ZSTD_createDDict(dict_buffer, dict_size);
+  ZSTD_DDict* const ddict = zstd_ruby_create_ddict(dict_buffer, dict_size);
   if (ddict == NULL) {
     rb_raise(rb_eRuntimeError, "%s", "ZSTD_createDDict failed");
   }
 
   DATA_PTR(self) = ddict;
+  rb_obj_freeze(self);
   return self;
 }
 
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
+static VALUE rb_cdict_dict_id(VALUE self)
+{
+  ZSTD_CDict* cdict = DATA_PTR(self);
+  return UINT2NUM(ZSTD_getDictID_fromCDict(cdict));
+}
+
+static VALUE rb_cdict_memsize(VALUE self)
+{
+  ZSTD_CDict* cdict = DATA_PTR(self);
+  return SIZET2NUM(ZSTD_sizeof_CDict(cdict));
+}
+
+/*
+ * The parameters ZSTD_createCDict selects (ZSTD_cpm_createCDict mode): the source size is unknown,
+ * so it is assumed to be small (513 bytes) and the tables are sized for the dictionary, and hash
+ * tables of the fast and dfast strategies keep 8 bits for tags.
+ */
+static VALUE rb_cdict_compression_parameters(VALUE self)
+{
+  int compression_level = NUM2INT(rb_iv_get(self, "@compression_level"));
+  size_t dict_size = NUM2SIZET(rb_iv_get(self, "@size"));
+  ZSTD_compressionParameters cparams = ZSTD_getCParams(compression_level, ZSTD_CONTENTSIZE_UNKNOWN, dict_size);
+  if (dict_size > 0) {
+    cparams = ZSTD_adjustCParams(cparams, 513, dict_size);
+  }
+  if (cparams.strategy == ZSTD_fast || cparams.strategy == ZSTD_dfast) {
+    if (cparams.hashLog > 24) cparams.hashLog = 24;
+    if (cparams.chainLog > 24) cparams.chainLog = 24;
+  }
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, ID2SYM(rb_intern("window_log")), UINT2NUM(cparams.windowLog));
+  rb_hash_aset(result, ID2SYM(rb_intern("chain_log")), UINT2NUM(cparams.chainLog));
+  rb_hash_aset(result, ID2SYM(rb_intern("hash_log")), UINT2NUM(cparams.hashLog));
+  rb_hash_aset(result, ID2SYM(rb_intern("search_log")), UINT2NUM(cparams.searchLog));
+  rb_hash_aset(result, ID2SYM(rb_intern("min_match")), UINT2NUM(cparams.minMatch));
+  rb_hash_aset(result, ID2SYM(rb_intern("target_length")), UINT2NUM(cparams.targetLength));
+  rb_hash_aset(result, ID2SYM(rb_intern("strategy")), INT2NUM(cparams.strategy));
+  return result;
+}
+#endif
+
+static VALUE rb_ddict_dict_id(VALUE self)
+{
+  ZSTD_DDict* ddict = DATA_PTR(self);
+  return UINT2NUM(ZSTD_getDictID_fromDDict(ddict));
+}
+
+static VALUE rb_ddict_memsize(VALUE self)
+{
+  ZSTD_DDict* ddict = DATA_PTR(self);
+  return SIZET2NUM(ZSTD_sizeof_DDict(ddict));
+}
+
+static VALUE rb_frame_dict_id(VALUE self, VALUE input_value)
+{
+  StringValue(input_value);
+  return UINT2NUM(ZSTD_getDictID_fromFrame(RSTRING_PTR(input_value), RSTRING_LEN(input_value)));
+}
+
 static VALUE rb_prohibit_copy(VALUE self, VALUE obj)
 {
   rb_raise(rb_eRuntimeError, "CDict cannot be duplicated");
@@ -210,14 +464,31 @@ void
 zstd_ruby_init(void)
 {
   rb_define_module_function(rb_mZstd, "zstd_version", zstdVersion, 0);
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
   rb_define_module_function(rb_mZstd, "compress", rb_compress, -1);
+#endif
   rb_define_module_function(rb_mZstd, "decompress", rb_decompress, -1);
+  rb_define_module_function(rb_mZstd, "frame_dict_id", rb_frame_dict_id, 1);
 
+#ifndef ZSTD_RUBY_DECOMPRESS_ONLY
   rb_define_alloc_func(rb_cCDict, rb_cdict_alloc);
   rb_define_private_method(rb_cCDict, "initialize", rb_cdict_initialize, -1);
   rb_define_method(rb_cCDict, "initialize_copy", rb_prohibit_copy, 1);
+  rb_define_method(rb_cCDict, "dict_id", rb_cdict_dict_id, 0);
+  rb_define_method(rb_cCDict, "memsize", rb_cdict_memsize, 0);
+  rb_define_method(rb_cCDict, "compression_parameters", rb_cdict_compression_parameters, 0);
+  rb_define_attr(rb_cCDict, "size", 1, 0);
+  rb_define_attr(rb_cCDict, "header_size", 1, 0);
+  rb_define_attr(rb_cCDict, "content_type", 1, 0);
+  rb_define_attr(rb_cCDict, "compression_level", 1, 0);
+#endif
 
   rb_define_alloc_func(rb_cDDict, rb_ddict_alloc);
   rb_define_private_method(rb_cDDict, "initialize", rb_ddict_initialize, 1);
   rb_define_method(rb_cDDict, "initialize_copy", rb_prohibit_copy, 1);
+  rb_define_method(rb_cDDict, "dict_id", rb_ddict_dict_id, 0);
+  rb_define_method(rb_cDDict, "memsize", rb_ddict_memsize, 0);
+  rb_define_attr(rb_cDDict, "size", 1, 0);
+  rb_define_attr(rb_cDDict, "header_size", 1, 0);
+  rb_define_attr(rb_cDDict, "content_type", 1, 0);
 }
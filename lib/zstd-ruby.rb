@@ -1,7 +1,12 @@
 require "zstd-ruby/version"
 require "zstd-ruby/zstdruby"
+require "zstd-ruby/future"
+require "zstd-ruby/fiber_io"
 require "zstd-ruby/stream_writer"
 require "zstd-ruby/stream_reader"
+require "zstd-ruby/seekable"
+require "zstd-ruby/stats"
+require "zstd-ruby/fork_hook"
 
 module Zstd
 end
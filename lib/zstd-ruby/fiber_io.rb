@@ -0,0 +1,57 @@
+module Zstd
+  # IO and CPU helpers of StreamWriter and StreamReader for code running under a Fiber scheduler
+  # (e.g. Async/Falcon): IO goes through read_nonblock/write_nonblock and waits with
+  # wait_readable/wait_writable, which yield to the scheduler, and (de)compression of chunks of at
+  # least `offload_threshold` bytes runs on a helper thread while the calling fiber waits for it.
+  # Without a scheduler the plain blocking calls are used.
+  module FiberIO
+    private
+
+    def fiber_scheduler?
+      Fiber.respond_to?(:scheduler) && !Fiber.scheduler.nil?
+    end
+
+    def nonblocking_io?(method)
+      fiber_scheduler? && @io.respond_to?(method) && @io.respond_to?(:wait_readable)
+    end
+
+    def io_write(data)
+      return @io.write(data) unless nonblocking_io?(:write_nonblock)
+
+      total = data.bytesize
+      until data.empty?
+        written = @io.write_nonblock(data, exception: false)
+        if written == :wait_writable
+          @io.wait_writable
+        else
+          data = data.byteslice(written, data.bytesize - written)
+        end
+      end
+      total
+    end
+
+    # Returns at most `length` bytes and nil at the end of the stream. Under a scheduler this
+    # returns whatever is available instead of waiting for `length` bytes.
+    def io_read(length)
+      return (@io.eof? ? nil : @io.read(length)) unless nonblocking_io?(:read_nonblock)
+
+      loop do
+        data = @io.read_nonblock(length, exception: false)
+        return data unless data == :wait_readable
+
+        @io.wait_readable
+      end
+    end
+
+    # Runs a (de)compression call on the stream. The libzstd call releases the GVL, so while a helper
+    # thread works on a large chunk the scheduler thread keeps running other fibers; Thread#value
+    # blocks only the calling fiber. The lock keeps those fibers off the stream in the meantime.
+    def with_stream(bytesize, &block)
+      return yield unless fiber_scheduler?
+
+      @stream_lock.synchronize do
+        @offload_threshold && bytesize >= @offload_threshold ? Thread.new(&block).value : yield
+      end
+    end
+  end
+end
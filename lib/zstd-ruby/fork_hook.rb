@@ -0,0 +1,22 @@
+module Zstd
+  # Restores process-wide state in a forked child: threads of the parent do not exist there.
+  module ForkHook
+    def _fork
+      pid = super
+      Zstd.send(:after_fork_child) if pid == 0
+      pid
+    end
+  end
+
+  class << self
+    private
+
+    def after_fork_child
+      async_after_fork
+      restart_trace_dispatcher
+    end
+  end
+
+  # Process._fork is called by every fork of Ruby 3.1 and later
+  Process.singleton_class.prepend(ForkHook) if Process.respond_to?(:_fork)
+end
@@ -0,0 +1,25 @@
+require 'io/wait'
+
+module Zstd
+  # Result of Zstd.compress_async and Zstd.decompress_async, computed on a native thread pool.
+  # `to_io` returns an IO that becomes readable once the result is ready, for IO.select or event loops.
+  class Future
+    # Waits at most `timeout` seconds, forever with nil. Returns self when the result is ready and nil on timeout.
+    # The wait goes through IO#wait_readable, so under a Fiber scheduler only the calling fiber waits.
+    def wait(timeout = nil)
+      deadline = timeout && Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout
+      until ready?
+        remaining = deadline && deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        return nil if remaining && remaining <= 0
+        to_io.wait_readable(remaining)
+      end
+      self
+    end
+
+    # The (de)compressed String, waiting for it if needed. Raises RuntimeError when libzstd failed.
+    def value
+      wait
+      result
+    end
+  end
+end
@@ -0,0 +1,196 @@
+require 'digest'
+require 'zstd-ruby'
+
+module Zstd
+  module Rack
+    # Rack middleware compressing response bodies with `Content-Encoding: zstd`, and with `dcz`
+    # (Compression Dictionary Transport, RFC 9842) when the client announces a dictionary the server
+    # knows through `Available-Dictionary`. Does not depend on the rack gem.
+    #
+    #   use Zstd::Rack::Deflater, level: 3, dictionaries: [File.binread('site.dict')]
+    #
+    # Bodies are compressed while they are enumerated, through StreamingCompress objects taken from a
+    # pool. `sync: true` flushes after each chunk so every chunk reaches the client at once,
+    # `sync: false` leaves it to libzstd and `sync: N` flushes once N bytes were buffered.
+    class Deflater
+      DCZ_HEADER = "\x5e\x2a\x4d\x18\x20\x00\x00\x00".b
+      # image/svg+xml is text
+      INCOMPRESSIBLE_TYPES = %r{\A(?:image/(?!svg)|audio/|video/|font/woff|application/(?:zip|gzip|x-gzip|zstd|x-bzip2|x-xz|x-7z-compressed|pdf|octet-stream)\b)}i
+
+      # level: compression level
+      # min_size: responses with a known length below this many bytes are sent as they are
+      # sync: true, false or a number of bytes, see above
+      # include: content types to compress; by default everything but INCOMPRESSIBLE_TYPES
+      # dictionaries: raw dictionaries for dcz, identified by their SHA-256
+      # condition: callable taking (env, status, headers, body); the response is compressed when it returns true
+      # pool_size: StreamingCompress objects kept per dictionary
+      # stream_options: more keyword arguments of StreamingCompress.new, e.g. latency: :low
+      def initialize(app, level: 3, min_size: 1024, sync: true, include: nil, dictionaries: [], condition: nil, pool_size: 16, stream_options: {})
+        @app = app
+        @level = level
+        @min_size = min_size
+        @sync = sync
+        @include = include
+        @condition = condition
+        @stream_options = stream_options
+        @dictionaries = dictionaries.to_h do |dictionary|
+          [":#{[Digest::SHA256.digest(dictionary)].pack('m0')}:", Dictionary.new(dictionary, level)]
+        end
+        @vary = @dictionaries.empty? ? ['Accept-Encoding'] : ['Accept-Encoding', 'Available-Dictionary']
+        @pool = StreamPool.new(pool_size)
+      end
+
+      def call(env)
+        status, headers, body = response = @app.call(env)
+        return response unless compressible?(env, status, headers, body)
+
+        add_vary(headers)
+        encoding, dictionary = negotiate(env)
+        return response if encoding.nil?
+
+        delete_header(headers, 'Content-Length')
+        delete_header(headers, 'Content-Encoding')
+        headers['content-encoding'] = encoding
+        stream = @pool.checkout(dictionary) { StreamingCompress.new(level: @level, dict: dictionary&.cdict, **@stream_options) }
+        prefix = dictionary && DCZ_HEADER + dictionary.sha256
+        [status, headers, Body.new(body, stream, @sync, prefix) { @pool.checkin(dictionary, stream) }]
+      end
+
+      private
+
+      def compressible?(env, status, headers, body)
+        return false if status < 200 || status == 204 || status == 304
+        return false unless body.respond_to?(:each)
+        return false if (encoding = header(headers, 'Content-Encoding')) && !encoding.casecmp?('identity')
+        return false if header(headers, 'Cache-Control').to_s.match?(/\bno-transform\b/i)
+
+        type = header(headers, 'Content-Type').to_s[/\A[^;\s]+/]
+        if @include
+          return false unless @include.include?(type)
+        elsif type&.match?(INCOMPRESSIBLE_TYPES)
+          return false
+        end
+        return false if (size = known_size(headers, body)) && size < @min_size
+
+        @condition.nil? || @condition.call(env, status, headers, body)
+      end
+
+      def known_size(headers, body)
+        length = header(headers, 'Content-Length')
+        return length.to_i if length
+        body.sum(&:bytesize) if body.is_a?(Array)
+      end
+
+      # returns [content coding, dictionary or nil], or nil when the client takes neither zstd nor dcz
+      def negotiate(env)
+        accepted = {}
+        env['HTTP_ACCEPT_ENCODING'].to_s.split(',').each do |part|
+          coding, *params = part.split(';').map(&:strip)
+          q = params.find { |param| param.start_with?('q=') }
+          accepted[coding.downcase] = q ? q[2..].to_f : 1.0 unless coding.nil? || coding.empty?
+        end
+
+        if accepted.fetch('dcz', 0) > 0 && (dictionary = @dictionaries[env['HTTP_AVAILABLE_DICTIONARY'].to_s.strip])
+          ['dcz', dictionary]
+        elsif accepted.fetch('zstd') { accepted.fetch('*', 0) } > 0
+          ['zstd', nil]
+        end
+      end
+
+      def add_vary(headers)
+        key = header_key(headers, 'Vary')
+        vary = key ? headers[key].to_s.split(',').map(&:strip) : []
+        return if vary.include?('*')
+
+        missing = @vary.reject { |name| vary.any? { |value| value.casecmp?(name) } }
+        return if missing.empty?
+
+        headers.delete(key) if key
+        headers['vary'] = (vary + missing).join(', ')
+      end
+
+      # plain Hash headers of Rack 2 applications may use any case
+      def header_key(headers, name)
+        headers.each_key.find { |key| key.casecmp?(name) }
+      end
+
+      def header(headers, name)
+        key = header_key(headers, name)
+        key && headers[key]
+      end
+
+      def delete_header(headers, name)
+        key = header_key(headers, name)
+        headers.delete(key) if key
+      end
+    end
+
+    class Dictionary
+      attr_reader :cdict, :sha256
+
+      def initialize(dictionary, level)
+        @cdict = CDict.new(dictionary, level)
+        @sha256 = Digest::SHA256.digest(dictionary)
+      end
+    end
+
+    # StreamingCompress objects can start a new frame after finish, so they are reused across responses
+    class StreamPool
+      def initialize(size)
+        @size = size
+        @streams = Hash.new { |hash, key| hash[key] = [] }
+        @lock = Thread::Mutex.new
+      end
+
+      def checkout(key)
+        @lock.synchronize { @streams[key].pop } || yield
+      end
+
+      def checkin(key, stream)
+        @lock.synchronize do
+          streams = @streams[key]
+          streams.push(stream) if streams.size < @size
+        end
+      end
+    end
+
+    class Body
+      def initialize(body, stream, sync, prefix, &release)
+        @body = body
+        @stream = stream
+        @sync = sync
+        @prefix = prefix
+        @release = release
+        @finished = false
+      end
+
+      def each
+        yield @prefix if @prefix
+        buffered = 0
+        @body.each do |chunk|
+          next if chunk.empty?
+
+          buffered += chunk.bytesize
+          if @sync == true || (@sync.is_a?(Integer) && buffered >= @sync)
+            buffered = 0
+            @stream.write(chunk)
+            compressed = @stream.flush
+          else
+            compressed = @stream.compress(chunk)
+          end
+          yield compressed unless compressed.empty?
+        end
+        yield @stream.finish
+        @finished = true
+      end
+
+      # a stream left in the middle of a frame by an aborted response is not reused
+      def close
+        @body.close if @body.respond_to?(:close)
+      ensure
+        @release.call if @finished
+        @finished = false
+      end
+    end
+  end
+end
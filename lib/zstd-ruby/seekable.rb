@@ -0,0 +1,132 @@
+module Zstd
+  # Zstandard seekable format
+  # https://github.com/facebook/zstd/blob/dev/contrib/seekable_format/zstd_seekable_compression_format.md
+  module Seekable
+    SKIPPABLE_MAGIC_NUMBER = 0x184D2A5E
+    MAGIC_NUMBER = 0x8F92EAB1
+    FOOTER_SIZE = 9
+    MAX_FRAME_SIZE = 1 << 30
+    MAX_FRAMES = 0x8000000
+
+    class Writer
+      def initialize(io, frame_size: 1024 * 1024, level: nil, dict: nil)
+        raise ArgumentError, "frame_size must be between 1 and #{MAX_FRAME_SIZE}" unless frame_size.between?(1, MAX_FRAME_SIZE)
+        @io = io
+        @frame_size = frame_size
+        @stream = Zstd::StreamingCompress.new(level: level, dict: dict)
+        @frame_pos = 0
+        @entries = []
+      end
+
+      def write(*data)
+        data.each do |str|
+          str = str.to_s.b
+          pos = 0
+          while pos < str.bytesize
+            chunk = str.byteslice(pos, @frame_size - @frame_pos)
+            @stream.write(chunk)
+            @frame_pos += chunk.bytesize
+            pos += chunk.bytesize
+            end_frame if @frame_pos == @frame_size
+          end
+        end
+      end
+
+      def finish
+        end_frame if @frame_pos > 0
+        @io.write(seek_table)
+      end
+
+      def close
+        finish
+        @io.close
+      end
+
+      private
+
+      def end_frame
+        raise StandardError, "too many frames" if @entries.size >= MAX_FRAMES
+        compressed = @stream.finish
+        @io.write(compressed)
+        @entries << [compressed.bytesize, @frame_pos]
+        @frame_pos = 0
+      end
+
+      def seek_table
+        table = @entries.flatten.pack('V*') << [@entries.size, 0, MAGIC_NUMBER].pack('VCV')
+        Zstd.write_skippable_frame(''.b, table, magic_variant: SKIPPABLE_MAGIC_NUMBER & 0xF)
+      end
+    end
+
+    class Reader
+      attr_reader :size, :frame_count
+
+      def initialize(io, cache_size: 8, dict: nil)
+        @io = io
+        @cache_size = cache_size
+        @dict = dict
+        @cache = {}
+        read_seek_table
+      end
+
+      def pread(offset, length)
+        raise ArgumentError, "negative offset or length" if offset < 0 || length < 0
+        return ''.b if length == 0 || offset >= @size
+        last = [offset + length, @size].min
+        index = frame_index(offset)
+        result = ''.b
+        while index < @frame_count && @d_offsets[index] < last
+          frame = decompress_frame(index)
+          from = [offset - @d_offsets[index], 0].max
+          to = [last - @d_offsets[index], frame.bytesize].min
+          result << frame.byteslice(from, to - from)
+          index += 1
+        end
+        result
+      end
+
+      def read_all
+        pread(0, @size)
+      end
+
+      private
+
+      def read_seek_table
+        @io.seek(-FOOTER_SIZE, IO::SEEK_END)
+        frame_count, descriptor, magic = @io.read(FOOTER_SIZE).unpack('VCV')
+        raise StandardError, "seek table not found" unless magic == MAGIC_NUMBER
+        entry_size = (descriptor & 0x80) != 0 ? 12 : 8
+        table_size = frame_count * entry_size + FOOTER_SIZE
+        @io.seek(-(table_size + 8), IO::SEEK_END)
+        skippable_magic, frame_size = @io.read(8).unpack('VV')
+        raise StandardError, "invalid seek table" unless skippable_magic == SKIPPABLE_MAGIC_NUMBER && frame_size == table_size
+        entries = @io.read(frame_count * entry_size).unpack(entry_size == 12 ? 'VVV' * frame_count : 'VV' * frame_count)
+
+        @frame_count = frame_count
+        @c_offsets = [0]
+        @d_offsets = [0]
+        entries.each_slice(entry_size / 4) do |compressed_size, decompressed_size|
+          @c_offsets << @c_offsets.last + compressed_size
+          @d_offsets << @d_offsets.last + decompressed_size
+        end
+        @size = @d_offsets.last
+      end
+
+      def frame_index(offset)
+        (0...@frame_count).bsearch { |i| @d_offsets[i + 1] > offset }
+      end
+
+      # decoded frames are kept in an LRU cache
+      def decompress_frame(index)
+        if (frame = @cache.delete(index))
+          return @cache[index] = frame
+        end
+        @io.seek(@c_offsets[index])
+        compressed = @io.read(@c_offsets[index + 1] - @c_offsets[index])
+        frame = @dict ? Zstd.decompress(compressed, dict: @dict) : Zstd.decompress(compressed)
+        @cache.delete(@cache.first[0]) if @cache.size >= @cache_size && !@cache.empty?
+        @cache_size > 0 ? @cache[index] = frame : frame
+      end
+    end
+  end
+end
@@ -0,0 +1,52 @@
+module Zstd
+  @trace_subscribers = []
+  @trace_dispatcher = nil
+
+  class << self
+    # Subscribes to every compression and decompression, ActiveSupport::Notifications style.
+    # The block is called with the event name ("compress.zstd" or "decompress.zstd") and a payload hash,
+    # shortly after the (de)compression finished, on a dedicated thread of the main Ractor.
+    def subscribe(&block)
+      raise ArgumentError, "block is required" unless block
+      raise NotImplementedError, "trace subscribers require native threads" unless trace_events_supported?
+      @trace_subscribers << block
+      self.trace_events = true
+      self.stats_enabled = true
+      start_trace_dispatcher
+      block
+    end
+
+    def unsubscribe(subscriber)
+      @trace_subscribers.delete(subscriber)
+      self.trace_events = false if @trace_subscribers.empty?
+      subscriber
+    end
+
+    private
+
+    # the dispatcher thread does not survive fork
+    def restart_trace_dispatcher
+      start_trace_dispatcher unless @trace_subscribers.empty?
+    end
+
+    # subscribers run on this thread, never in the middle of other Ruby code, so they may take locks
+    def start_trace_dispatcher
+      return if @trace_dispatcher&.alive?
+
+      @trace_dispatcher = Thread.new do
+        loop { dispatch_trace_events(wait_trace_events) }
+      end
+      @trace_dispatcher.name = 'zstd-trace'
+    end
+
+    def dispatch_trace_events(events)
+      events.each do |name, payload|
+        @trace_subscribers.each do |subscriber|
+          subscriber.call(name, payload)
+        rescue StandardError => e
+          warn "Zstd trace subscriber raised #{e.class}: #{e.message}"
+        end
+      end
+    end
+  end
+end
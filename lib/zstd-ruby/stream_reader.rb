@@ -1,17 +1,22 @@
 module Zstd
   # @todo Exprimental
   class StreamReader
-    def initialize(io)
+    include FiberIO
+
+    # offload_threshold: reads of at least this many bytes are decompressed on a helper thread when a Fiber scheduler is active
+    def initialize(io, offload_threshold: nil)
       @io = io
       @stream = Zstd::StreamingDecompress.new
+      @offload_threshold = offload_threshold
+      @stream_lock = Thread::Mutex.new
     end
 
     def read(length)
-      if @io.eof?
+      data = io_read(length)
+      if data.nil?
         raise StandardError, "EOF"
       end
-      data = @io.read(length)
-      @stream.decompress(data)
+      with_stream(data.bytesize) { @stream.decompress(data) }
     end
 
     def close
@@ -1,22 +1,30 @@
 module Zstd
   # @todo Exprimental
   class StreamWriter
-    def initialize(io, level: nil)
+    include FiberIO
+
+    # offload_threshold: chunks of at least this many bytes are compressed on a helper thread when a Fiber scheduler is active
+    def initialize(io, level: nil, offload_threshold: nil, **kwargs)
       @io = io
-      @stream = Zstd::StreamingCompress.new(level: level)
+      @stream = Zstd::StreamingCompress.new(level: level, **kwargs)
+      @offload_threshold = offload_threshold
+      @stream_lock = Thread::Mutex.new
     end
 
     def write(*data)
-      @stream.write(*data)
-      @io.write(@stream.flush)
+      compressed = with_stream(data.sum { |chunk| chunk.to_s.bytesize }) do
+        @stream.write(*data)
+        @stream.flush
+      end
+      io_write(compressed)
     end
 
     def finish
-      @io.write(@stream.finish)
+      io_write(with_stream(0) { @stream.finish })
     end
 
     def close
-      @io.write(@stream.finish)
+      finish
       @io.close
     end
   end
@@ -0,0 +1,75 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'securerandom'
+
+RSpec.describe Zstd do
+  let(:user_json) do
+    File.read("#{__dir__}/user_springmt.json")
+  end
+
+  describe 'frame_info' do
+    it 'should return the frame header' do
+      compressed = Zstd.compress(user_json)
+      info = Zstd.frame_info(compressed)
+      expect(info[:frame_type]).to eq(:zstd)
+      expect(info[:content_size]).to eq(user_json.bytesize)
+      expect(info[:compressed_size]).to eq(compressed.bytesize)
+      expect(info[:window_size]).to be > 0
+      expect(info[:dict_id]).to eq(0)
+      expect(info[:checksum]).to eq(false)
+      expect(info[:block_count]).to eq(1)
+    end
+
+    it 'should count blocks' do
+      data = Random.new(1).bytes(300 * 1024)
+      expect(Zstd.frame_info(Zstd.compress(data))[:block_count]).to eq(3)
+      expect(Zstd.frame_info(Zstd.compress(''))[:block_count]).to eq(1)
+    end
+
+    it 'should return nil content size for streaming frames' do
+      stream = Zstd::StreamingCompress.new
+      stream << user_json
+      info = Zstd.frame_info(stream.finish)
+      expect(info[:content_size]).to eq(nil)
+      expect(info[:checksum]).to eq(false)
+    end
+
+    it 'should return dict_id' do
+      compressed = Zstd.compress(user_json, dict: File.read("#{__dir__}/dictionary"))
+      expect(Zstd.frame_info(compressed)[:dict_id]).to eq(Zstd.frame_dict_id(compressed))
+    end
+
+    it 'should support offset and skippable frames' do
+      compressed = Zstd.compress(user_json, metadata: 'meta', magic_variant: 2)
+      expect(Zstd.frame_info(compressed)).to eq({ compressed_size: 12, frame_type: :skippable, content_size: 4, magic_variant: 2 })
+      expect(Zstd.frame_info(compressed, offset: 12)[:content_size]).to eq(user_json.bytesize)
+    end
+
+    it 'should raise exception with broken data' do
+      expect { Zstd.frame_info('abcdefgh') }.to raise_error(RuntimeError)
+      expect { Zstd.frame_info(Zstd.compress(user_json)[0..-5]) }.to raise_error(RuntimeError)
+      expect { Zstd.frame_info('', offset: 1) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe 'decompressed_size' do
+    it 'should sum all frames' do
+      compressed = Zstd.compress(user_json) + Zstd.compress(user_json)
+      expect(Zstd.decompressed_size(compressed)).to eq(user_json.bytesize * 2)
+      expect(Zstd.decompressed_size_bound(compressed)).to eq(user_json.bytesize * 2)
+    end
+
+    it 'should return nil for unknown sizes' do
+      stream = Zstd::StreamingCompress.new
+      stream << user_json
+      compressed = stream.finish
+      expect(Zstd.decompressed_size(compressed)).to eq(nil)
+      expect(Zstd.decompressed_size_bound(compressed)).to be >= user_json.bytesize
+    end
+
+    it 'should raise exception with broken data' do
+      expect { Zstd.decompressed_size('abc') }.to raise_error(RuntimeError)
+      expect { Zstd.decompressed_size_bound('abc') }.to raise_error(RuntimeError)
+    end
+  end
+end
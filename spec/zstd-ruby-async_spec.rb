@@ -0,0 +1,152 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'securerandom'
+
+RSpec.describe Zstd::Future do
+  let(:user_json) do
+    File.read("#{__dir__}/user_springmt.json")
+  end
+  let(:dictionary) do
+    File.read("#{__dir__}/dictionary")
+  end
+  let(:large) { user_json * 2000 }
+
+  describe 'compress_async' do
+    it 'should compress in the background' do
+      future = Zstd.compress_async(large, level: 5)
+      expect(future).to be_a(Zstd::Future)
+      expect(future.value).to eq(Zstd.compress(large, level: 5))
+      expect(future.ready?).to eq(true)
+      expect(future.value).to equal(future.value)
+    end
+
+    it 'should support dict and checksum' do
+      cdict = Zstd::CDict.new(dictionary)
+      compressed = Zstd.compress_async(user_json, dict: cdict, checksum: true).value
+      expect(Zstd.frame_info(compressed)[:checksum]).to eq(true)
+      expect(Zstd.decompress(compressed, dict: dictionary)).to eq(user_json)
+    end
+
+    it 'should not be affected by later changes of the input' do
+      input = large.dup
+      future = Zstd.compress_async(input)
+      input.replace('changed')
+      expect(Zstd.decompress(future.value)).to eq(large)
+    end
+
+    it 'should raise exception with unsupported object' do
+      expect { Zstd.compress_async(Object.new) }.to raise_error(TypeError)
+    end
+  end
+
+  describe 'decompress_async' do
+    it 'should decompress in the background' do
+      expect(Zstd.decompress_async(Zstd.compress(large)).value).to eq(large)
+    end
+
+    it 'should decompress frames without a content size' do
+      stream = Zstd::StreamingCompress.new
+      stream << large
+      expect(Zstd.decompress_async(stream.finish).value).to eq(large)
+    end
+
+    it 'should support dict' do
+      compressed = Zstd.compress(user_json, dict: dictionary)
+      expect(Zstd.decompress_async(compressed, dict: Zstd::DDict.new(dictionary)).value).to eq(user_json)
+    end
+
+    it 'should raise exception with invalid data' do
+      expect { Zstd.decompress_async('abc') }.to raise_error(RuntimeError, /not a zstd frame/)
+    end
+
+    it 'should raise exception from value when decompression fails' do
+      compressed = Zstd.compress(user_json, dict: dictionary)
+      expect { Zstd.decompress_async(compressed).value }.to raise_error(RuntimeError, /decompress error/)
+    end
+
+    it 'should not trust content sizes the blocks cannot hold' do
+      # one RLE block of a single byte in a frame declaring 1 TB
+      forged = [0xFD2FB528, 0xE0, 1 << 40, 0x0B, 0, 0].pack('VCQ<C3') + 'a'
+      expect { Zstd.decompress_async(forged).value }.to raise_error(RuntimeError, /decompress error/)
+    end
+  end
+
+  describe 'wait' do
+    it 'should return the future once the result is ready' do
+      future = Zstd.compress_async(user_json)
+      expect(future.wait).to equal(future)
+      expect(future.ready?).to eq(true)
+      expect(future.wait(0)).to equal(future)
+    end
+  end
+
+  describe 'to_io' do
+    it 'should become readable once the result is ready' do
+      futures = Array.new(20) { |i| Zstd.compress_async("#{user_json}#{SecureRandom.hex(i)}") }
+      pending = futures.dup
+      until pending.empty?
+        readable, = IO.select(pending.map(&:to_io))
+        pending.reject! { |future| readable.include?(future.to_io) }
+      end
+      expect(futures.all?(&:ready?)).to eq(true)
+      futures.each { |future| expect(Zstd.decompress(future.value)).to start_with(user_json) }
+    end
+
+    it 'should be readable for a future that is already done' do
+      future = Zstd.compress_async(user_json)
+      future.wait
+      expect(IO.select([future.to_io], nil, nil, 1)).not_to be_nil
+    end
+  end
+
+  it 'should keep buffers alive when futures are dropped' do
+    compressed = Zstd.compress(large)
+    10.times do
+      Zstd.compress_async(large)
+      Zstd.decompress_async(compressed)
+      GC.start
+    end
+    expect(Zstd.decompress_async(compressed).value).to eq(large)
+  end
+
+  it 'should fail futures that were pending when the process forked' do
+    skip 'fork is not supported' unless Process.respond_to?(:fork) && Process.respond_to?(:_fork)
+    threads = Zstd.async_threads
+    Zstd.async_threads = 1
+    input = Random.new(1).bytes(1 << 22) * 4
+    futures = Array.new(3) { Zstd.compress_async(input, level: 19) }
+    io = futures.last.to_io
+    reader, writer = IO.pipe
+    pid = fork do
+      reader.close
+      readable = !IO.select([io], nil, nil, 10).nil?
+      error = begin
+        futures.last.value
+        nil
+      rescue RuntimeError => e
+        e.message
+      end
+      writer.write(Marshal.dump([readable, error, Zstd.compress_async('abc').value]))
+      exit!(0)
+    end
+    writer.close
+    readable, error, compressed = Marshal.load(reader.read)
+    Process.wait(pid)
+    expect(readable).to eq(true)
+    expect(error).to eq('forked while pending')
+    expect(Zstd.decompress(compressed)).to eq('abc')
+    expect(futures.map { |future| Zstd.decompress(future.value) }).to all(eq(input))
+  ensure
+    Zstd.async_threads = threads
+  end
+
+  it 'should resize the worker pool' do
+    threads = Zstd.async_threads
+    Zstd.async_threads = 2
+    expect(Zstd.async_threads).to eq(2)
+    expect(Zstd.compress_async(user_json).value).to eq(Zstd.compress(user_json))
+    expect { Zstd.async_threads = 0 }.to raise_error(ArgumentError)
+  ensure
+    Zstd.async_threads = threads
+  end
+end
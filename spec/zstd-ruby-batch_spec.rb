@@ -0,0 +1,96 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'securerandom'
+
+RSpec.describe Zstd do
+  let(:user_json) do
+    File.read("#{__dir__}/user_springmt.json")
+  end
+  let(:dictionary) do
+    File.read("#{__dir__}/dictionary")
+  end
+  let(:messages) do
+    Array.new(100) { |i| "#{user_json}#{i}#{SecureRandom.hex(i)}" }
+  end
+
+  describe 'compress_batch' do
+    it 'should compress each message into an independent frame' do
+      compressed = Zstd.compress_batch(messages)
+      expect(compressed.length).to eq(messages.length)
+      compressed.each_with_index do |c, i|
+        expect(Zstd.decompress(c)).to eq(messages[i])
+      end
+    end
+
+    it 'should support level and dict' do
+      compressed = Zstd.compress_batch(messages, level: 10, dict: Zstd::CDict.new(dictionary))
+      expect(compressed[0]).to eq(Zstd.compress(messages[0], dict: Zstd::CDict.new(dictionary)))
+      expect(Zstd.decompress(compressed[1], dict: dictionary)).to eq(messages[1])
+    end
+
+    it 'should give the same result with threads' do
+      expect(Zstd.compress_batch(messages, threads: 4)).to eq(Zstd.compress_batch(messages))
+    end
+
+    it 'should work with an empty array' do
+      expect(Zstd.compress_batch([])).to eq([])
+    end
+
+    it 'should raise exception with unsupported object' do
+      expect { Zstd.compress_batch("abc") }.to raise_error(TypeError)
+      expect { Zstd.compress_batch(["abc", Object.new]) }.to raise_error(TypeError)
+      expect { Zstd.compress_batch(["abc"], threads: 0) }.to raise_error(ArgumentError)
+    end
+
+    it 'should free the contexts when an option raises' do
+      Zstd.malloc_stats_enabled = true
+      Zstd.reset_malloc_stats
+      expect { Zstd.compress_batch(messages, level: 'x', threads: 2) }.to raise_error(TypeError)
+      expect { Zstd.compress_batch(messages, level: 1 << 40, threads: 2) }.to raise_error(RangeError)
+      expect { Zstd.compress(messages.join, level: 1 << 40, parallel: 2, frame_size: 1000) }.to raise_error(RangeError)
+      expect { Zstd.decompress_batch(Zstd.compress_batch(messages), dict: 1, threads: 2) }.to raise_error(ArgumentError)
+      stats = Zstd.malloc_stats
+      expect(stats[:allocations]).to be > 0
+      expect(stats[:frees]).to eq(stats[:allocations])
+    ensure
+      Zstd.malloc_stats_enabled = false
+    end
+  end
+
+  describe 'decompress_batch' do
+    it 'should decompress each frame' do
+      compressed = Zstd.compress_batch(messages)
+      expect(Zstd.decompress_batch(compressed)).to eq(messages)
+      expect(Zstd.decompress_batch(compressed, threads: 3)).to eq(messages)
+    end
+
+    it 'should support dict' do
+      compressed = Zstd.compress_batch(messages, dict: dictionary)
+      expect(Zstd.decompress_batch(compressed, dict: Zstd::DDict.new(dictionary))).to eq(messages)
+    end
+
+    it 'should decompress frames without content size' do
+      compressed = messages.map do |m|
+        stream = Zstd::StreamingCompress.new
+        stream << m
+        stream.finish
+      end
+      expect(Zstd.decompress_batch(compressed, threads: 2)).to eq(messages)
+    end
+
+    it 'should raise exception with broken data' do
+      compressed = Zstd.compress_batch(messages)
+      compressed[3] = "abc"
+      expect { Zstd.decompress_batch(compressed) }.to raise_error(RuntimeError)
+      expect { Zstd.decompress_batch([Zstd.compress(user_json)[0..-5]]) }.to raise_error(RuntimeError)
+    end
+
+    it 'should not trust content sizes the blocks cannot hold' do
+      # one RLE block of a single byte in a frame declaring 1 TB
+      forged = [0xFD2FB528, 0xE0, 1 << 40, 0x0B, 0, 0].pack('VCQ<C3') + 'a'
+      expect(Zstd.decompressed_size(forged)).to eq(1 << 40)
+      expect { Zstd.decompress_batch([forged]) }.to raise_error(RuntimeError, /decompress error/)
+      expect { Zstd.decompress_batch([Zstd.compress('abc'), forged], threads: 2) }.to raise_error(RuntimeError, /index 1/)
+    end
+  end
+end
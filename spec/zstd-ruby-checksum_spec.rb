@@ -0,0 +1,46 @@
+require "spec_helper"
+require 'zstd-ruby'
+
+RSpec.describe Zstd do
+  let(:user_json) do
+    File.read("#{__dir__}/user_springmt.json")
+  end
+  let(:broken_checksum) do
+    compressed = Zstd.compress(user_json, checksum: true)
+    compressed[-1] = (compressed[-1].ord ^ 0xff).chr
+    compressed
+  end
+
+  describe 'checksum' do
+    it 'should write a content checksum' do
+      expect(Zstd.frame_info(Zstd.compress(user_json, checksum: true))[:checksum]).to eq(true)
+      expect(Zstd.frame_info(Zstd.compress(user_json, checksum: false))[:checksum]).to eq(false)
+      expect(Zstd.frame_info(Zstd.compress(user_json, checksum: true, frame_size: 100))[:checksum]).to eq(true)
+      expect(Zstd.frame_info(Zstd.compress_batch([user_json], checksum: true)[0])[:checksum]).to eq(true)
+    end
+
+    it 'should write a content checksum with StreamingCompress' do
+      stream = Zstd::StreamingCompress.new(checksum: true)
+      stream << user_json
+      compressed = stream.finish
+      expect(Zstd.frame_info(compressed)[:checksum]).to eq(true)
+      expect(Zstd.decompress(compressed)).to eq(user_json)
+    end
+  end
+
+  describe 'verify_checksum' do
+    it 'should verify the checksum by default' do
+      expect { Zstd.decompress(broken_checksum) }.to raise_error(RuntimeError)
+      expect { Zstd.decompress(broken_checksum, parallel: 2) }.to raise_error(RuntimeError)
+      expect { Zstd.decompress_batch([broken_checksum]) }.to raise_error(RuntimeError)
+      expect { Zstd::StreamingDecompress.new.decompress(broken_checksum) }.to raise_error(RuntimeError)
+    end
+
+    it 'should skip the checksum with verify_checksum: false' do
+      expect(Zstd.decompress(broken_checksum, verify_checksum: false)).to eq(user_json)
+      expect(Zstd.decompress(broken_checksum, verify_checksum: false, parallel: 2)).to eq(user_json)
+      expect(Zstd.decompress_batch([broken_checksum], verify_checksum: false)).to eq([user_json])
+      expect(Zstd::StreamingDecompress.new(verify_checksum: false).decompress(broken_checksum)).to eq(user_json)
+    end
+  end
+end
@@ -0,0 +1,138 @@
+require "spec_helper"
+require 'zstd-ruby'
+
+# Minimal Fiber scheduler on top of IO.select, enough for the IO and Thread#value hooks
+class SpecFiberScheduler
+  def initialize
+    @readable = {}
+    @writable = {}
+    @waiting = {}
+    @blocked = 0
+    @ready = []
+    @lock = Thread::Mutex.new
+    @wakeup, @notify = IO.pipe
+  end
+
+  def run
+    while @readable.any? || @writable.any? || @waiting.any? || @blocked > 0 || @lock.synchronize { @ready.any? }
+      readable, writable = IO.select(@readable.keys + [@wakeup], @writable.keys, [], timeout)
+      readable&.each do |io|
+        io == @wakeup ? @wakeup.read_nonblock(64, exception: false) : @readable.delete(io)&.resume
+      end
+      writable&.each { |io| @writable.delete(io)&.resume }
+      now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      @waiting.select { |_, deadline| deadline <= now }.each_key { |fiber| @waiting.delete(fiber) && fiber.resume }
+      ready = @lock.synchronize { @ready.slice!(0..) }
+      ready.each { |fiber| fiber.resume if fiber.alive? }
+    end
+  end
+
+  def timeout
+    return 0 if @lock.synchronize { @ready.any? }
+    deadline = @waiting.values.min
+    deadline && [deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC), 0].max
+  end
+
+  def io_wait(io, events, _timeout)
+    @readable[io] = Fiber.current if events & IO::READABLE != 0
+    @writable[io] = Fiber.current if events & IO::WRITABLE != 0
+    Fiber.yield
+    events
+  ensure
+    @readable.delete(io)
+    @writable.delete(io)
+  end
+
+  def kernel_sleep(duration = nil)
+    @waiting[Fiber.current] = Process.clock_gettime(Process::CLOCK_MONOTONIC) + (duration || 0)
+    Fiber.yield
+  end
+
+  def block(_blocker, _timeout = nil)
+    @blocked += 1
+    Fiber.yield
+  ensure
+    @blocked -= 1
+  end
+
+  def unblock(_blocker, fiber)
+    @lock.synchronize { @ready << fiber }
+    @notify.write_nonblock('.', exception: false)
+  end
+
+  def fiber(&block)
+    Fiber.new(blocking: false, &block).tap(&:resume)
+  end
+
+  def close
+    run
+    @wakeup.close
+    @notify.close
+  end
+end
+
+RSpec.describe 'Zstd streams under a Fiber scheduler' do
+  def with_scheduler
+    thread = Thread.new do
+      Fiber.set_scheduler(SpecFiberScheduler.new)
+      yield
+    end
+    thread.join
+  end
+
+  # incompressible, so the compressed stream is larger than a pipe buffer
+  let(:data) { Random.new(1).bytes(1024 * 1024) }
+
+  def roundtrip_through_pipe(data, **options)
+    result = +''
+    with_scheduler do
+      reader_io, writer_io = IO.pipe
+      Fiber.schedule do
+        writer = Zstd::StreamWriter.new(writer_io, **options)
+        (0...data.bytesize).step(256 * 1024) { |pos| writer.write(data.byteslice(pos, 256 * 1024)) }
+        writer.close
+      end
+      Fiber.schedule do
+        reader = Zstd::StreamReader.new(reader_io, **options)
+        loop do
+          result << reader.read(64 * 1024)
+        rescue StandardError => e
+          raise unless e.message == 'EOF'
+          break
+        end
+        reader_io.close
+      end
+    end
+    result
+  end
+
+  it 'should stream through a pipe from fibers of one thread' do
+    expect(roundtrip_through_pipe(data)).to eq(data)
+  end
+
+  it 'should offload large chunks to a helper thread' do
+    expect(roundtrip_through_pipe(data, offload_threshold: 128 * 1024)).to eq(data)
+  end
+
+  it 'should keep running other fibers while a chunk is compressed' do
+    ticks = 0
+    compressed = nil
+    with_scheduler do
+      io = StringIO.new
+      Fiber.schedule do
+        writer = Zstd::StreamWriter.new(io, level: 19, offload_threshold: 1)
+        writer.write(data)
+        writer.finish
+        compressed = io.string
+      end
+      Fiber.schedule do
+        while compressed.nil?
+          ticks += 1
+          sleep 0.001
+        end
+      end
+    end
+    expect(ticks).to be > 1
+    expect(Zstd.decompress(compressed)).to eq(data)
+  end
+end
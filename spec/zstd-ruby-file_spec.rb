@@ -0,0 +1,138 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'tmpdir'
+
+RSpec.describe Zstd do
+  let(:user_json) do
+    File.read("#{__dir__}/user_springmt.json")
+  end
+  let(:dictionary) do
+    File.read("#{__dir__}/dictionary")
+  end
+  # larger than the 16MB between progress callbacks
+  let(:data) { Random.new(1).bytes(64 * 1024) * 300 + user_json }
+
+  around do |example|
+    Dir.mktmpdir('zstd-ruby-file') do |dir|
+      @dir = dir
+      example.run
+    end
+  end
+
+  def path(name)
+    File.join(@dir, name)
+  end
+
+  describe 'compress_file' do
+    it 'should compress a file into another one' do
+      File.binwrite(path('src'), data)
+      written = Zstd.compress_file(path('src'), path('dst.zst'), level: 1)
+      expect(written).to eq(File.size(path('dst.zst')))
+      compressed = File.binread(path('dst.zst'))
+      expect(Zstd.frame_info(compressed)[:content_size]).to eq(data.bytesize)
+      expect(Zstd.decompress(compressed)).to eq(data)
+    end
+
+    it 'should support dict, checksum and threads' do
+      File.binwrite(path('src'), user_json)
+      Zstd.compress_file(path('src'), path('dict.zst'), dict: Zstd::CDict.new(dictionary), checksum: true)
+      expect(Zstd.decompress(File.binread(path('dict.zst')), dict: dictionary)).to eq(user_json)
+      File.binwrite(path('src'), data)
+      Zstd.compress_file(path('src'), path('threads.zst'), threads: 2)
+      expect(Zstd.decompress(File.binread(path('threads.zst')))).to eq(data)
+    end
+
+    it 'should report progress' do
+      File.binwrite(path('src'), data)
+      calls = []
+      written = Zstd.compress_file(path('src'), path('dst.zst'), progress: ->(read, written) { calls << [read, written] })
+      expect(calls.size).to be > 1
+      expect(calls.last).to eq([data.bytesize, written])
+      expect(calls.map(&:first)).to eq(calls.map(&:first).sort)
+    end
+
+    it 'should raise exception with a missing file' do
+      expect { Zstd.compress_file(path('missing'), path('dst.zst')) }.to raise_error(Errno::ENOENT)
+      expect(File.exist?(path('dst.zst'))).to eq(false)
+    end
+
+    it 'should refuse to write over the source' do
+      File.binwrite(path('src'), user_json)
+      File.symlink(path('src'), path('link'))
+      expect { Zstd.compress_file(path('src'), path('src')) }.to raise_error(ArgumentError, /same file/)
+      expect { Zstd.compress_file(path('src'), path('link')) }.to raise_error(ArgumentError, /same file/)
+      expect(File.binread(path('src'))).to eq(user_json)
+      expect(Dir.children(@dir).sort).to eq(['link', 'src'])
+    end
+
+    it 'should keep the mode of an existing destination' do
+      File.binwrite(path('src'), user_json)
+      File.binwrite(path('dst.zst'), 'secret')
+      File.chmod(0600, path('dst.zst'))
+      Zstd.compress_file(path('src'), path('dst.zst'))
+      expect(File.stat(path('dst.zst')).mode & 07777).to eq(0600)
+      expect(File.stat(path('dst.zst')).uid).to eq(Process.euid)
+      Zstd.decompress_file(path('dst.zst'), path('dst.zst.out'))
+      File.chmod(0640, path('dst.zst.out'))
+      Zstd.decompress_file(path('dst.zst'), path('dst.zst.out'))
+      expect(File.stat(path('dst.zst.out')).mode & 07777).to eq(0640)
+      expect(File.binread(path('dst.zst.out'))).to eq(user_json)
+    end
+
+    it 'should only take regular files' do
+      skip 'mkfifo is not supported' unless File.respond_to?(:mkfifo)
+      File.binwrite(path('src'), user_json)
+      File.mkfifo(path('fifo'))
+      expect { Zstd.compress_file(path('fifo'), path('dst.zst')) }.to raise_error(ArgumentError, /not a regular file/)
+      expect { Zstd.compress_file(path('src'), path('fifo')) }.to raise_error(ArgumentError, /not a regular file/)
+      expect { Zstd.compress_file(@dir, path('dst.zst')) }.to raise_error(ArgumentError, /not a regular file/)
+      expect(Dir.children(@dir).sort).to eq(['fifo', 'src'])
+    end
+
+    it 'should raise exception with invalid arguments' do
+      File.binwrite(path('src'), user_json)
+      expect { Zstd.compress_file(path('src'), path('dst.zst'), threads: 0) }.to raise_error(ArgumentError)
+      expect { Zstd.compress_file(path('src'), path('dst.zst'), progress: 1) }.to raise_error(TypeError)
+    end
+  end
+
+  describe 'decompress_file' do
+    it 'should decompress a file into another one' do
+      File.binwrite(path('src.zst'), Zstd.compress(user_json) + Zstd.compress(data))
+      expect(Zstd.decompress_file(path('src.zst'), path('dst'))).to eq(user_json.bytesize + data.bytesize)
+      expect(File.binread(path('dst'))).to eq(user_json + data)
+    end
+
+    it 'should decompress output of compress_file with dict' do
+      File.binwrite(path('src'), user_json)
+      Zstd.compress_file(path('src'), path('src.zst'), dict: dictionary)
+      Zstd.decompress_file(path('src.zst'), path('dst'), dict: Zstd::DDict.new(dictionary))
+      expect(File.binread(path('dst'))).to eq(user_json)
+    end
+
+    it 'should raise exception with truncated or invalid input' do
+      File.binwrite(path('truncated.zst'), Zstd.compress(data).byteslice(0, 1000))
+      expect { Zstd.decompress_file(path('truncated.zst'), path('dst')) }.to raise_error(RuntimeError, /truncated frame/)
+      File.binwrite(path('invalid.zst'), user_json)
+      expect { Zstd.decompress_file(path('invalid.zst'), path('dst')) }.to raise_error(RuntimeError, /decompress error/)
+    end
+
+    it 'should leave the destination alone when decompression fails' do
+      File.binwrite(path('truncated.zst'), Zstd.compress(data).byteslice(0, 1000))
+      expect { Zstd.decompress_file(path('truncated.zst'), path('dst')) }.to raise_error(RuntimeError)
+      expect(Dir.children(@dir)).to eq(['truncated.zst'])
+      File.binwrite(path('dst'), 'previous')
+      expect { Zstd.decompress_file(path('truncated.zst'), path('dst')) }.to raise_error(RuntimeError)
+      expect(File.binread(path('dst'))).to eq('previous')
+      expect(Dir.children(@dir).sort).to eq(['dst', 'truncated.zst'])
+    end
+
+    it 'should be interruptible' do
+      File.binwrite(path('src'), data * 4)
+      thread = Thread.new { Zstd.compress_file(path('src'), path('dst.zst'), level: 19) }
+      sleep 0.05
+      thread.kill
+      expect(thread.join(5)).to equal(thread)
+    end
+  end
+end
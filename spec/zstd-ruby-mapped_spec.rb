@@ -0,0 +1,177 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'tmpdir'
+
+RSpec.describe Zstd do
+  let(:user_json) do
+    File.read("#{__dir__}/user_springmt.json")
+  end
+  let(:dictionary) do
+    File.read("#{__dir__}/dictionary")
+  end
+  let(:data) { (user_json * 200).b }
+
+  around do |example|
+    Dir.mktmpdir('zstd-ruby-mapped') do |dir|
+      @dir = dir
+      example.run
+    end
+  end
+
+  def path(name)
+    File.join(@dir, name)
+  end
+
+  describe 'File inputs' do
+    it 'should compress and decompress a File in place' do
+      File.binwrite(path('src'), data)
+      compressed = File.open(path('src')) { |f| Zstd.compress(f, level: 5) }
+      expect(compressed).to eq(Zstd.compress(data, level: 5))
+      File.binwrite(path('src.zst'), compressed)
+      expect(File.open(path('src.zst')) { |f| Zstd.decompress(f) }).to eq(data)
+    end
+
+    it 'should read the whole file independently of the position' do
+      File.binwrite(path('src'), data)
+      File.open(path('src')) do |f|
+        f.read(100)
+        expect(Zstd.decompress(Zstd.compress(f))).to eq(data)
+      end
+    end
+
+    it 'should work with an empty file' do
+      File.binwrite(path('empty'), '')
+      expect(Zstd.decompress(File.open(path('empty')) { |f| Zstd.compress(f) })).to eq('')
+    end
+
+    it 'should read files that cannot be mapped' do
+      if File.respond_to?(:mkfifo)
+        File.mkfifo(path('fifo'))
+        writer = Thread.new { File.open(path('fifo'), 'w') { |f| f.write(data) } }
+        compressed = File.open(path('fifo')) { |f| Zstd.compress(f) }
+        writer.join
+        expect(Zstd.decompress(compressed)).to eq(data)
+      end
+      if File.exist?('/proc/self/cmdline')
+        cmdline = File.binread('/proc/self/cmdline')
+        expect(File.open('/proc/self/cmdline') { |f| Zstd.decompress(Zstd.compress(f)) }).to eq(cmdline)
+        stream = Zstd::StreamingCompress.new
+        File.open('/proc/self/cmdline') { |f| stream.compress(f) }
+        expect(Zstd.decompress(stream.finish)).to eq(cmdline)
+      end
+    end
+
+    it 'should be accepted by the streaming classes' do
+      File.binwrite(path('src'), data)
+      stream = Zstd::StreamingCompress.new
+      File.open(path('src')) { |f| stream.write(f, 'tail') }
+      compressed = stream.finish
+      File.binwrite(path('src.zst'), compressed)
+      decompressed = File.open(path('src.zst')) { |f| Zstd::StreamingDecompress.new.decompress(f) }
+      expect(decompressed).to eq(data + 'tail')
+    end
+  end
+
+  if defined?(IO::Buffer)
+    describe 'IO::Buffer inputs' do
+      around do |example|
+        experimental = Warning[:experimental]
+        Warning[:experimental] = false
+        example.run
+      ensure
+        Warning[:experimental] = experimental
+      end
+
+      it 'should compress and decompress a mapped IO::Buffer' do
+        File.binwrite(path('src'), data)
+        compressed = File.open(path('src')) do |f|
+          buffer = IO::Buffer.map(f, nil, 0, IO::Buffer::READONLY)
+          Zstd.compress(buffer, dict: dictionary)
+        end
+        expect(Zstd.decompress(IO::Buffer.for(compressed), dict: dictionary)).to eq(data)
+        expect(Zstd::StreamingDecompress.new(dict: dictionary).decompress(IO::Buffer.for(compressed))).to eq(data)
+      end
+
+      it 'should unlock the buffer after the call' do
+        buffer = IO::Buffer.for(Zstd.compress(data))
+        Zstd.decompress(buffer)
+        expect(buffer.locked?).to eq(false)
+        expect { Zstd.decompress(IO::Buffer.for('abc')) }.to raise_error(RuntimeError)
+        expect(buffer.locked?).to eq(false)
+      end
+    end
+  end
+
+  describe 'output:' do
+    it 'should decompress into a mapped file' do
+      compressed = Zstd.compress(data)
+      written = File.open(path('dst'), 'w+') { |f| Zstd.decompress(compressed, output: f) }
+      expect(written).to eq(data.bytesize)
+      expect(File.binread(path('dst'))).to eq(data)
+    end
+
+    it 'should write files that cannot be mapped and frames without a content size' do
+      File.open(path('dst'), 'w') { |f| Zstd.decompress(Zstd.compress(data), output: f) }
+      expect(File.binread(path('dst'))).to eq(data)
+
+      stream = Zstd::StreamingCompress.new
+      stream << data
+      File.binwrite(path('dst'), 'previous content that is longer than nothing')
+      File.open(path('dst'), 'r+') { |f| Zstd.decompress(stream.finish, output: f) }
+      expect(File.binread(path('dst'))).to eq(data)
+    end
+
+    it 'should support dict' do
+      compressed = Zstd.compress(user_json, dict: dictionary)
+      File.open(path('dst'), 'w+') { |f| Zstd.decompress(compressed, dict: Zstd::DDict.new(dictionary), output: f) }
+      expect(File.binread(path('dst'))).to eq(user_json)
+    end
+
+    it 'should raise exception with invalid data' do
+      File.open(path('dst'), 'w+') do |f|
+        expect { Zstd.decompress('abc', output: f) }.to raise_error(RuntimeError)
+        expect { Zstd.decompress(Zstd.compress(data).byteslice(0, 100), output: f) }.to raise_error(RuntimeError, /decompress error/)
+      end
+      expect { Zstd.decompress(Zstd.compress(data), output: 'path') }.to raise_error(TypeError)
+    end
+
+    it 'should not grow the file to a forged content size' do
+      forged = [0xFD2FB528, 0xE0, 1 << 40, 0x0B, 0, 0].pack('VCQ<C3') + 'a'
+      File.open(path('dst'), 'w+') do |f|
+        expect { Zstd.decompress(forged, output: f) }.to raise_error(RuntimeError, /decompress/)
+      end
+      expect(File.size(path('dst'))).to eq(0)
+    end
+
+    it 'should leave an empty file when decompression fails' do
+      compressed = Zstd.compress(data, checksum: true)
+      corrupted = compressed.byteslice(0, compressed.bytesize - 4) + "\0\0\0\0"
+      [compressed.byteslice(0, compressed.bytesize / 2), corrupted].each do |input|
+        File.binwrite(path('dst'), 'previous')
+        File.open(path('dst'), 'r+') do |f|
+          expect { Zstd.decompress(input, output: f) }.to raise_error(RuntimeError, /decompress error/)
+        end
+        expect(File.size(path('dst'))).to eq(0)
+      end
+    end
+
+    it 'should write into pipes and files opened for appending' do
+      reader, writer = IO.pipe
+      consumer = Thread.new { reader.read }
+      expect(Zstd.decompress(Zstd.compress(data), output: writer)).to eq(data.bytesize)
+      writer.close
+      expect(consumer.value).to eq(data)
+      reader.close
+
+      File.binwrite(path('dst'), 'previous')
+      File.open(path('dst'), 'a') { |f| Zstd.decompress(Zstd.compress(user_json), output: f) }
+      expect(File.binread(path('dst'))).to eq('previous' + user_json)
+    end
+
+    it 'should raise exception with a closed file' do
+      file = File.open(path('dst'), 'w+')
+      file.close
+      expect { Zstd.decompress(Zstd.compress(data), output: file) }.to raise_error(IOError)
+    end
+  end
+end
@@ -0,0 +1,111 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'zstd-ruby/rack'
+
+RSpec.describe Zstd::Rack::Deflater do
+  let(:user_json) do
+    File.read("#{__dir__}/user_springmt.json")
+  end
+  let(:dictionary) do
+    File.binread("#{__dir__}/dictionary")
+  end
+  let(:chunks) { Array.new(4) { |i| "#{user_json}#{i}" } }
+  let(:headers) { { 'content-type' => 'application/json' } }
+  let(:app) { ->(_env) { [200, headers.dup, chunks] } }
+  let(:available_dictionary) { ":#{[Digest::SHA256.digest(dictionary)].pack('m0')}:" }
+
+  def request(middleware, accept_encoding = 'gzip, zstd', **env)
+    status, headers, body = middleware.call({ 'HTTP_ACCEPT_ENCODING' => accept_encoding }.merge(env))
+    parts = []
+    body.each { |part| parts << part }
+    body.close if body.respond_to?(:close)
+    [status, headers, parts]
+  end
+
+  it 'should compress for clients accepting zstd' do
+    _, headers, parts = request(described_class.new(app))
+    expect(headers['content-encoding']).to eq('zstd')
+    expect(headers['vary']).to eq('Accept-Encoding')
+    expect(Zstd.decompress(parts.join)).to eq(chunks.join)
+  end
+
+  it 'should flush every chunk with sync' do
+    _, _, parts = request(described_class.new(app, sync: true))
+    stream = Zstd::StreamingDecompress.new
+    decompressed = parts.first(chunks.size).map { |part| stream.decompress(part) }
+    expect(decompressed).to eq(chunks)
+  end
+
+  it 'should leave flushing to libzstd without sync' do
+    _, _, parts = request(described_class.new(app, sync: false))
+    expect(parts.size).to be < chunks.size
+    expect(Zstd.decompress(parts.join)).to eq(chunks.join)
+  end
+
+  it 'should honor q-values and wildcards' do
+    middleware = described_class.new(app)
+    expect(request(middleware, 'gzip, zstd;q=0')[1]).not_to have_key('content-encoding')
+    expect(request(middleware, 'gzip')[1]).not_to have_key('content-encoding')
+    expect(request(middleware, '*')[1]['content-encoding']).to eq('zstd')
+    expect(request(middleware, 'zstd;q=0, *')[1]).not_to have_key('content-encoding')
+  end
+
+  it 'should skip small, already compressed and non-transformable responses' do
+    expect(request(described_class.new(->(_env) { [200, headers, ['small']] }))[1]).not_to have_key('content-encoding')
+    [
+      { 'content-type' => 'image/png' },
+      { 'content-type' => 'text/plain', 'content-encoding' => 'gzip' },
+      { 'content-type' => 'text/plain', 'cache-control' => 'no-transform' },
+    ].each do |response_headers|
+      _, headers, parts = request(described_class.new(->(_env) { [200, response_headers, chunks] }))
+      expect(headers['content-encoding']).to eq(response_headers['content-encoding'])
+      expect(parts).to eq(chunks)
+    end
+    expect(request(described_class.new(->(_env) { [304, {}, []] }))[1]).to eq({})
+  end
+
+  it 'should stream bodies of unknown length' do
+    body = Enumerator.new { |y| chunks.each { |chunk| y << chunk } }
+    _, headers, parts = request(described_class.new(->(_env) { [200, { 'Content-Type' => 'text/plain', 'Content-Length' => '1' }.merge('Vary' => 'Origin'), body] }, min_size: 0))
+    expect(headers).not_to have_key('Content-Length')
+    expect(headers['vary']).to eq('Origin, Accept-Encoding')
+    expect(Zstd.decompress(parts.join)).to eq(chunks.join)
+  end
+
+  it 'should replace a mixed-case identity content coding' do
+    _, headers, parts = request(described_class.new(->(_env) { [200, { 'Content-Type' => 'text/plain', 'Content-Encoding' => 'identity' }, chunks] }))
+    expect(headers).not_to have_key('Content-Encoding')
+    expect(headers['content-encoding']).to eq('zstd')
+    expect(Zstd.decompress(parts.join)).to eq(chunks.join)
+  end
+
+  it 'should compress with a dictionary announced by the client' do
+    middleware = described_class.new(app, dictionaries: [dictionary])
+    _, headers, parts = request(middleware, 'zstd, dcz', 'HTTP_AVAILABLE_DICTIONARY' => available_dictionary)
+    expect(headers['content-encoding']).to eq('dcz')
+    expect(headers['vary']).to eq('Accept-Encoding, Available-Dictionary')
+    body = parts.join
+    expect(body.byteslice(0, 8)).to eq(Zstd::Rack::Deflater::DCZ_HEADER)
+    expect(body.byteslice(8, 32)).to eq(Digest::SHA256.digest(dictionary))
+    expect(Zstd.decompress(body.byteslice(40..), dict: dictionary)).to eq(chunks.join)
+
+    _, headers, = request(middleware, 'zstd, dcz', 'HTTP_AVAILABLE_DICTIONARY' => ':unknown:')
+    expect(headers['content-encoding']).to eq('zstd')
+  end
+
+  it 'should reuse streams of finished responses' do
+    middleware = described_class.new(app)
+    streams = Array.new(2) do
+      _, _, body = middleware.call('HTTP_ACCEPT_ENCODING' => 'zstd')
+      body.each {}
+      body.close
+      body.instance_variable_get(:@stream)
+    end
+    expect(streams[0]).to equal(streams[1])
+
+    _, _, body = middleware.call('HTTP_ACCEPT_ENCODING' => 'zstd')
+    body.close
+    _, _, parts = request(middleware)
+    expect(Zstd.decompress(parts.join)).to eq(chunks.join)
+  end
+end
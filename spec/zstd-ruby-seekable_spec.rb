@@ -0,0 +1,64 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'stringio'
+
+RSpec.describe Zstd::Seekable do
+  let(:data) do
+    Random.new(7).bytes(1000) * 100 + File.read("#{__dir__}/user_springmt.json").b * 100
+  end
+
+  def write_seekable(data, **opts)
+    io = StringIO.new
+    writer = Zstd::Seekable::Writer.new(io, **opts)
+    (0...data.bytesize).step(3000) { |pos| writer.write(data.byteslice(pos, 3000)) }
+    writer.finish
+    io.rewind
+    io
+  end
+
+  describe 'Writer' do
+    it 'should write frames readable by Zstd.decompress' do
+      io = write_seekable(data, frame_size: 10_000)
+      expect(Zstd.decompress(io.read)).to eq(data)
+    end
+
+    it 'should support level and dict' do
+      dictionary = File.read("#{__dir__}/dictionary")
+      io = write_seekable(data, frame_size: 10_000, level: 10, dict: dictionary)
+      expect(Zstd.decompress(io.read, dict: dictionary)).to eq(data)
+    end
+  end
+
+  describe 'Reader' do
+    it 'should read the seek table' do
+      reader = Zstd::Seekable::Reader.new(write_seekable(data, frame_size: 10_000))
+      expect(reader.size).to eq(data.bytesize)
+      expect(reader.frame_count).to eq((data.bytesize + 9_999) / 10_000)
+    end
+
+    it 'should read bytes at arbitrary offsets' do
+      reader = Zstd::Seekable::Reader.new(write_seekable(data, frame_size: 10_000), cache_size: 2)
+      [[0, 10], [9_995, 10], [10_000, 10_000], [55_555, 33_333], [data.bytesize - 5, 100], [0, data.bytesize]].each do |offset, length|
+        expect(reader.pread(offset, length)).to eq(data.byteslice(offset, length))
+      end
+      expect(reader.pread(data.bytesize, 10)).to eq('')
+      expect(reader.read_all).to eq(data)
+    end
+
+    it 'should read the output of Zstd.compress with seek_table' do
+      reader = Zstd::Seekable::Reader.new(StringIO.new(Zstd.compress(data, frame_size: 4096, seek_table: true)))
+      expect(reader.frame_count).to eq((data.bytesize + 4095) / 4096)
+      expect(reader.pread(12_345, 6_789)).to eq(data.byteslice(12_345, 6_789))
+    end
+
+    it 'should work with an empty stream' do
+      reader = Zstd::Seekable::Reader.new(write_seekable(''))
+      expect(reader.size).to eq(0)
+      expect(reader.pread(0, 10)).to eq('')
+    end
+
+    it 'should raise exception without seek table' do
+      expect { Zstd::Seekable::Reader.new(StringIO.new(Zstd.compress(data))) }.to raise_error(StandardError)
+    end
+  end
+end
@@ -0,0 +1,187 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'stringio'
+
+RSpec.describe Zstd do
+  describe 'stats' do
+    before do
+      skip 'trace hooks are not supported' unless Zstd.stats_supported?
+      Zstd.reset_stats
+      Zstd.stats_enabled = true
+    end
+
+    after do
+      Zstd.stats_enabled = false if Zstd.stats_supported?
+    end
+
+    it 'should aggregate counters per level' do
+      compressed = Zstd.compress('abc' * 1000, level: 7)
+      Zstd.compress('abc' * 1000, level: 7)
+      Zstd.decompress(compressed)
+
+      stat = Zstd.stats[:compress].find { |s| s[:level] == 7 }
+      expect(stat[:calls]).to eq(2)
+      expect(stat[:dict_id]).to eq(0)
+      expect(stat[:bytes_in]).to eq(6000)
+      expect(stat[:bytes_out]).to eq(compressed.bytesize * 2)
+      expect(stat[:nanoseconds]).to be > 0
+
+      stat = Zstd.stats[:decompress].first
+      expect(stat[:calls]).to eq(1)
+      expect(stat[:bytes_in]).to eq(compressed.bytesize)
+      expect(stat[:bytes_out]).to eq(3000)
+    end
+
+    it 'should aggregate counters per dictionary' do
+      dictionary = File.read("#{__dir__}/dictionary")
+      compressed = Zstd.compress('abc' * 1000, dict: dictionary)
+      Zstd.decompress(compressed, dict: dictionary)
+      dict_id = Zstd::CDict.new(dictionary).dict_id
+      expect(Zstd.stats[:compress].map { |s| s[:dict_id] }).to eq([dict_id])
+      expect(Zstd.stats[:decompress].map { |s| s[:dict_id] }).to eq([dict_id])
+    end
+
+    it 'should count streaming compression' do
+      stream = Zstd::StreamingCompress.new(level: 2)
+      stream << 'abc' * 1000
+      res = stream.finish
+      stat = Zstd.stats[:compress].find { |s| s[:level] == 2 }
+      expect(stat[:bytes_in]).to eq(3000)
+      expect(stat[:bytes_out]).to eq(res.bytesize)
+    end
+
+    it 'should not count while disabled' do
+      Zstd.stats_enabled = false
+      Zstd.compress('abc')
+      expect(Zstd.stats[:compress]).to eq([])
+    end
+
+    it 'should notify subscribers' do
+      skip 'trace subscribers are not supported' unless Zstd.trace_events_supported?
+      events = []
+      subscriber = Zstd.subscribe { |name, payload| events << [name, payload] }
+      begin
+        Zstd.decompress(Zstd.compress('abc' * 100, level: 4))
+        Thread.pass while events.size < 2
+      ensure
+        Zstd.unsubscribe(subscriber)
+      end
+      expect(events.map(&:first)).to eq(['compress.zstd', 'decompress.zstd'])
+      expect(events[0][1][:level]).to eq(4)
+      expect(events[0][1][:bytes_in]).to eq(300)
+      expect(events[1][1][:bytes_out]).to eq(300)
+    end
+
+    it 'should call subscribers outside of the code that compressed' do
+      skip 'trace subscribers are not supported' unless Zstd.trace_events_supported?
+      lock = Thread::Mutex.new
+      names = Thread::Queue.new
+      subscriber = Zstd.subscribe { |name, _payload| lock.synchronize { names << [name, Thread.current.name] } }
+      begin
+        lock.synchronize do
+          Zstd.compress('abc')
+          sleep 0.01
+        end
+        expect(names.pop).to eq(['compress.zstd', 'zstd-trace'])
+      ensure
+        Zstd.unsubscribe(subscriber)
+      end
+    end
+
+    it 'should warn with the message of a subscriber error' do
+      skip 'trace subscribers are not supported' unless Zstd.trace_events_supported?
+      names = Thread::Queue.new
+      failing = Zstd.subscribe { |_name, _payload| raise 'boom' }
+      subscriber = Zstd.subscribe { |name, _payload| names << name }
+      stderr = $stderr
+      $stderr = StringIO.new
+      begin
+        Zstd.compress('abc')
+        names.pop
+        expect($stderr.string).to include('RuntimeError: boom')
+      ensure
+        $stderr = stderr
+        Zstd.unsubscribe(failing)
+        Zstd.unsubscribe(subscriber)
+      end
+    end
+
+    it 'should keep notifying subscribers in a forked child' do
+      skip 'trace subscribers are not supported' unless Zstd.trace_events_supported?
+      skip 'fork is not supported' unless Process.respond_to?(:fork)
+      names = Thread::Queue.new
+      subscriber = Zstd.subscribe { |name, _payload| names << name }
+      begin
+        reader, writer = IO.pipe
+        pid = fork do
+          reader.close
+          Zstd.decompress(Zstd.compress('abc'))
+          writer.write("#{names.pop} #{names.pop}")
+          exit!(0)
+        end
+        writer.close
+        expect(reader.read).to eq('compress.zstd decompress.zstd')
+        Process.wait(pid)
+      ensure
+        Zstd.unsubscribe(subscriber)
+      end
+    end
+
+    it 'should count events dropped while subscribers are behind' do
+      skip 'trace subscribers are not supported' unless Zstd.trace_events_supported?
+      entered = Thread::Queue.new
+      release = Thread::Queue.new
+      subscriber = Zstd.subscribe do |_name, _payload|
+        if entered.empty?
+          entered << true
+          release.pop
+        end
+      end
+      begin
+        Zstd.compress('abc')
+        entered.pop
+        5000.times { Zstd.compress('abc') }
+        expect(Zstd.stats[:dropped_events]).to be >= 5000 - 4096
+      ensure
+        release << true
+        Zstd.unsubscribe(subscriber)
+      end
+    end
+  end
+
+  describe 'malloc_stats' do
+    before do
+      Zstd.malloc_stats_enabled = true
+      Zstd.reset_malloc_stats
+    end
+
+    after do
+      Zstd.malloc_stats_enabled = false
+    end
+
+    it 'should count memory allocated by libzstd' do
+      data = 'abc' * 100_000
+      Zstd.decompress(Zstd.compress(data))
+      stats = Zstd.malloc_stats
+      expect(stats[:allocations]).to be > 0
+      expect(stats[:frees]).to eq(stats[:allocations])
+      expect(stats[:allocated_bytes]).to be > 0
+      expect(stats[:peak_bytes]).to be <= stats[:allocated_bytes]
+    end
+
+    it 'should count streaming contexts until they are freed' do
+      stream = Zstd::StreamingCompress.new
+      stream << 'abc' * 1000
+      stream.finish
+      stats = Zstd.malloc_stats
+      expect(stats[:current_bytes]).to be > 0
+      expect(stats[:peak_bytes]).to be >= stats[:current_bytes]
+    end
+
+    it 'should not count while disabled' do
+      Zstd.malloc_stats_enabled = false
+      Zstd.compress('abc')
+      expect(Zstd.malloc_stats[:allocations]).to eq(0)
+    end
+  end
+end
@@ -107,6 +107,135 @@ RSpec.describe Zstd::StreamingCompress do
     end
   end
 
+  describe 'target_block_size' do
+    let(:data) do
+      Random.new(3).bytes(100_000).unpack1('H*')
+    end
+
+    def block_count(compressed)
+      Zstd.frame_info(compressed)[:block_count]
+    end
+
+    it 'should split output into small blocks' do
+      stream = Zstd::StreamingCompress.new(target_block_size: 2048)
+      stream << data
+      res = stream.finish
+      default_stream = Zstd::StreamingCompress.new
+      default_stream << data
+      default_res = default_stream.finish
+
+      expect(block_count(res)).to be > block_count(default_res)
+      expect(Zstd.decompress(res)).to eq(data)
+    end
+
+    it 'should support latency: :low' do
+      stream = Zstd::StreamingCompress.new(latency: :low)
+      stream << data
+      res = stream.finish
+      expect(block_count(res)).to be > 1
+      expect(Zstd.decompress(res)).to eq(data)
+    end
+
+    it 'should be supported by StreamWriter' do
+      io = StringIO.new
+      writer = Zstd::StreamWriter.new(io, latency: :low)
+      writer.write(data)
+      writer.finish
+      expect(block_count(io.string)).to be > 1
+      expect(Zstd.decompress(io.string)).to eq(data)
+    end
+
+    it 'should raise exception with invalid arguments' do
+      expect { Zstd::StreamingCompress.new(target_block_size: 10) }.to raise_error(ArgumentError)
+      expect { Zstd::StreamingCompress.new(latency: :fast) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe 'progress' do
+    it 'should report the frame progression' do
+      stream = Zstd::StreamingCompress.new
+      stream << "abc" * 1000
+      progress = stream.progress
+      expect(progress[:ingested]).to eq(3000)
+      expect(progress[:current_job_id]).to eq(0)
+      expect(progress[:active_workers]).to eq(0)
+      expect(progress[:to_flush_now]).to eq(0)
+      stream.flush
+      progress = stream.progress
+      expect(progress[:consumed]).to eq(3000)
+      expect(progress[:produced]).to be > 0
+      expect(progress[:flushed]).to eq(progress[:produced])
+    end
+
+    it 'should count bytes across frames with total_in and total_out' do
+      stream = Zstd::StreamingCompress.new
+      res = stream.compress("abc" * 1000)
+      res << stream.finish
+      stream.write("def" * 1000)
+      res << stream.finish
+      expect(stream.total_in).to eq(6000)
+      expect(stream.total_out).to eq(res.bytesize)
+    end
+  end
+
+  describe 'memsize' do
+    it 'should include the compression context' do
+      require 'objspace'
+      stream = Zstd::StreamingCompress.new
+      stream << 'abc' * 1000
+      expect(ObjectSpace.memsize_of(stream)).to be > 100_000
+    end
+  end
+
+  describe 'adapt' do
+    let(:data) do
+      Random.new(5).bytes(1 << 20).unpack1('H*')
+    end
+
+    it 'should raise the level while the input never waits for compression' do
+      stream = Zstd::StreamingCompress.new(adapt: true, level: 1, max_level: 6)
+      expect(stream.level).to eq(1)
+      res = ''.b
+      chunk = data.byteslice(0, 64 * 1024)
+      10.times do
+        stream << chunk
+        res << stream.flush
+      end
+      res << stream.finish
+      expect(stream.level).to eq(6)
+      expect(Zstd.decompress(res)).to eq(chunk * 10)
+    end
+
+    it 'should lower the level while the input waits for compression' do
+      stream = Zstd::StreamingCompress.new(adapt: true, level: 1, min_level: -5)
+      input = data * 8
+      res = stream.compress(input)
+      res << stream.finish
+      expect(stream.level).to be < 1
+      expect(Zstd.decompress(res)).to eq(input)
+    end
+
+    it 'should clamp the initial level' do
+      expect(Zstd::StreamingCompress.new(adapt: true, level: 10, max_level: 5).level).to eq(5)
+      expect(Zstd::StreamingCompress.new(level: 10).level).to eq(10)
+    end
+
+    it 'should raise exception with invalid arguments' do
+      expect { Zstd::StreamingCompress.new(adapt: true, min_level: 5, max_level: 1) }.to raise_error(ArgumentError)
+      expect { Zstd::StreamingCompress.new(max_level: 5) }.to raise_error(ArgumentError)
+    end
+
+    it 'should not create a context for invalid levels' do
+      Zstd.malloc_stats_enabled = true
+      Zstd.reset_malloc_stats
+      expect { Zstd::StreamingCompress.new(adapt: true, max_level: 1 << 40) }.to raise_error(RangeError)
+      expect { Zstd::StreamingCompress.new(adapt: true, min_level: 'x') }.to raise_error(TypeError)
+      expect(Zstd.malloc_stats[:allocations]).to eq(0)
+    ensure
+      Zstd.malloc_stats_enabled = false
+    end
+  end
+
   if Gem::Version.new(RUBY_VERSION) >= Gem::Version.new('3.0.0')
     describe 'Ractor' do
       it 'should be supported' do
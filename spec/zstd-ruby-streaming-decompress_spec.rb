@@ -17,6 +17,20 @@ RSpec.describe Zstd::StreamingDecompress do
     end
   end
 
+  describe 'total_in and total_out' do
+    it 'should count consumed and produced bytes' do
+      str = "foo bar buzz" * 100
+      cstr = Zstd.compress(str)
+      stream = Zstd::StreamingDecompress.new
+      expect(stream.total_in).to eq(0)
+      stream.decompress(cstr[0, 5])
+      expect(stream.total_in).to eq(5)
+      stream.decompress(cstr[5..-1])
+      expect(stream.total_in).to eq(cstr.bytesize)
+      expect(stream.total_out).to eq(str.bytesize)
+    end
+  end
+
   describe 'decompress_with_pos' do
     it 'should return decompressed data and consumed input position' do
       str = "hello world test data"
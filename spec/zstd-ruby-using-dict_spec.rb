@@ -88,4 +88,99 @@ RSpec.describe Zstd do
     end
   end
 
+  describe 'dictionary introspection' do
+    let(:user_json) do
+      File.read("#{__dir__}/user_springmt.json")
+    end
+    let(:dictionary) do
+      File.read("#{__dir__}/dictionary")
+    end
+
+    it 'should expose CDict metadata' do
+      cdict = Zstd::CDict.new(dictionary, 10)
+      expect(cdict.dict_id).to eq(1096339042)
+      expect(cdict.size).to eq(dictionary.bytesize)
+      expect(cdict.header_size).to be > 0
+      expect(cdict.header_size).to be < dictionary.bytesize
+      expect(cdict.memsize).to be > 0
+      expect(cdict.content_type).to eq(:full)
+      expect(cdict.compression_level).to eq(10)
+      expect(cdict.compression_parameters[:window_log]).to be > 0
+      expect(cdict.compression_parameters).to_not eq(Zstd::CDict.new(dictionary, 1).compression_parameters)
+    end
+
+    it 'should report the parameters ZSTD_createCDict selects' do
+      # sized for the dictionary plus a small source, not for the level's default window
+      dict_window_log = Math.log2(dictionary.bytesize + 513 - 1).floor + 1
+      [1, 3, 9, 19].each do |level|
+        params = Zstd::CDict.new(dictionary, level).compression_parameters
+        expect(params[:window_log]).to eq(dict_window_log)
+        expect(params[:hash_log]).to be <= dict_window_log + 1
+      end
+      # frames take their window from the compression context, which is never smaller than the CDict's
+      cdict = Zstd::CDict.new(dictionary, 19)
+      stream = Zstd::StreamingCompress.new(dict: cdict)
+      compressed = stream.compress(dictionary * 4) + stream.finish
+      expect(Zstd.frame_info(compressed)[:window_size]).to be >= 1 << cdict.compression_parameters[:window_log]
+      expect(Zstd.frame_info(compressed)[:dict_id]).to eq(cdict.dict_id)
+    end
+
+    it 'should expose DDict metadata' do
+      ddict = Zstd::DDict.new(dictionary)
+      expect(ddict.dict_id).to eq(1096339042)
+      expect(ddict.size).to eq(dictionary.bytesize)
+      expect(ddict.memsize).to be > 0
+      expect(ddict.content_type).to eq(:full)
+    end
+
+    it 'should treat other buffers as raw content' do
+      cdict = Zstd::CDict.new(user_json)
+      expect(cdict.dict_id).to eq(0)
+      expect(cdict.header_size).to eq(0)
+      expect(cdict.content_type).to eq(:raw)
+      expect(cdict.compression_level).to eq(3)
+      expect(Zstd::DDict.new("").content_type).to eq(:raw)
+    end
+
+    it 'should return the dictionary id required by a frame' do
+      expect(Zstd.frame_dict_id(Zstd.compress(user_json, dict: dictionary))).to eq(1096339042)
+      expect(Zstd.frame_dict_id(Zstd.compress(user_json))).to eq(0)
+      expect(Zstd.frame_dict_id("abc")).to eq(0)
+    end
+  end
+
+  if Gem::Version.new(RUBY_VERSION) >= Gem::Version.new('3.0.0')
+    describe 'Ractor' do
+      let(:user_json) do
+        File.read("#{__dir__}/user_springmt.json")
+      end
+      let(:dictionary) do
+        File.read("#{__dir__}/dictionary")
+      end
+
+      it 'should freeze dictionaries so they are shareable' do
+        cdict = Zstd::CDict.new(dictionary)
+        ddict = Zstd::DDict.new(dictionary)
+        expect(cdict.frozen?).to eq(true)
+        expect(ddict.frozen?).to eq(true)
+        expect(Ractor.shareable?(cdict)).to eq(true)
+        expect(Ractor.shareable?(ddict)).to eq(true)
+        expect(Ractor.make_shareable(cdict)).to equal(cdict)
+      end
+
+      it 'should use shared dictionaries from other Ractors' do
+        cdict = Zstd::CDict.new(dictionary)
+        ddict = Zstd::DDict.new(dictionary)
+        input = user_json.freeze
+        ractors = 2.times.map do
+          Ractor.new(input, cdict, ddict) { |data, c, d| Zstd.decompress(Zstd.compress(data, dict: c), dict: d) }
+        end
+        # Ractor#take was replaced at Ruby 3.5.
+        # https://bugs.ruby-lang.org/issues/21262
+        results = ractors.map { |r| r.respond_to?(:take) ? r.take : r.value }
+        expect(results).to eq([user_json, user_json])
+      end
+    end
+  end
+
 end
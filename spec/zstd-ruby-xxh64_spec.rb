@@ -0,0 +1,106 @@
+require "spec_helper"
+require 'zstd-ruby'
+require 'tmpdir'
+
+RSpec.describe Zstd::XXH64 do
+  let(:user_json) do
+    File.read("#{__dir__}/user_springmt.json")
+  end
+  let(:data) { user_json * 100 }
+
+  describe 'digest' do
+    it 'should match the reference values' do
+      expect(Zstd::XXH64.digest('')).to eq(0xEF46DB3751D8E999)
+      expect(Zstd::XXH64.digest('abc')).to eq(0x44BC2CF5AD770999)
+    end
+
+    it 'should match the frame checksum' do
+      compressed = Zstd.compress(data, checksum: true)
+      expect(compressed.byteslice(-4, 4).unpack1('V')).to eq(Zstd::XXH64.digest(data) & 0xFFFFFFFF)
+    end
+
+    it 'should support a seed' do
+      expect(Zstd::XXH64.digest(data, 1)).not_to eq(Zstd::XXH64.digest(data))
+      expect(Zstd::XXH64.digest(data, 0)).to eq(Zstd::XXH64.digest(data))
+    end
+
+    it 'should hash a File in place' do
+      Dir.mktmpdir('zstd-ruby-xxh64') do |dir|
+        path = File.join(dir, 'data')
+        File.binwrite(path, data)
+        expect(File.open(path) { |f| Zstd::XXH64.digest(f) }).to eq(Zstd::XXH64.digest(data))
+      end
+    end
+
+    it 'should hash the whole File like File.binread' do
+      Dir.mktmpdir('zstd-ruby-xxh64') do |dir|
+        path = File.join(dir, 'data')
+        File.binwrite(path, data)
+        File.open(path) do |f|
+          f.read(100)
+          expect(Zstd::XXH64.digest(f)).to eq(Zstd::XXH64.digest(File.binread(path)))
+          expect(Zstd::XXH64.new.update(f).digest).to eq(Zstd::XXH64.digest(File.binread(path)))
+        end
+      end
+    end
+
+    it 'should hash a File that is not a regular file' do
+      if File.exist?('/proc/self/cmdline')
+        cmdline = File.binread('/proc/self/cmdline')
+        expect(cmdline).not_to eq('')
+        expect(File.open('/proc/self/cmdline') { |f| Zstd::XXH64.digest(f) }).to eq(Zstd::XXH64.digest(cmdline))
+      end
+      next unless File.respond_to?(:mkfifo)
+      Dir.mktmpdir('zstd-ruby-xxh64') do |dir|
+        fifo = File.join(dir, 'fifo')
+        File.mkfifo(fifo)
+        writer = Thread.new { File.open(fifo, 'w') { |f| f.write(data) } }
+        digest = File.open(fifo) { |f| Zstd::XXH64.new.update(f).digest }
+        writer.join
+        expect(digest).to eq(Zstd::XXH64.digest(data))
+      end
+    end
+
+    it 'should raise exception with unsupported object' do
+      expect { Zstd::XXH64.digest(1) }.to raise_error(TypeError)
+    end
+  end
+
+  describe 'streaming' do
+    it 'should give the one-shot digest' do
+      xxh = Zstd::XXH64.new
+      data.each_char.each_slice(1000) { |chars| xxh.update(chars.join) }
+      expect(xxh.digest).to eq(Zstd::XXH64.digest(data))
+      expect(xxh.digest).to eq(Zstd::XXH64.digest(data))
+    end
+
+    it 'should support seed, reset and dup' do
+      xxh = Zstd::XXH64.new(7)
+      xxh << user_json
+      copy = xxh.dup
+      copy << 'more'
+      expect(xxh.digest).to eq(Zstd::XXH64.digest(user_json, 7))
+      expect(copy.digest).to eq(Zstd::XXH64.digest("#{user_json}more", 7))
+      expect(xxh.reset.update('abc').digest).to eq(Zstd::XXH64.digest('abc', 7))
+    end
+  end
+
+  describe 'Zstd.compress with hash: true' do
+    it 'should return the frame and the digest of the input' do
+      compressed, hash = Zstd.compress(data, hash: true, level: 5)
+      expect(compressed).to eq(Zstd.compress(data, level: 5))
+      expect(hash).to eq(Zstd::XXH64.digest(data))
+    end
+
+    it 'should work with empty input, dict, metadata and parallel' do
+      expect(Zstd.compress('', hash: true)).to eq([Zstd.compress(''), Zstd::XXH64.digest('')])
+      dictionary = File.read("#{__dir__}/dictionary")
+      compressed, hash = Zstd.compress(user_json, hash: true, dict: dictionary, metadata: 'meta')
+      expect(Zstd.decompress(compressed, dict: dictionary)).to eq(user_json)
+      expect(hash).to eq(Zstd::XXH64.digest(user_json))
+      compressed, hash = Zstd.compress(data, hash: true, parallel: 2, frame_size: 4096)
+      expect(Zstd.decompress(compressed)).to eq(data)
+      expect(hash).to eq(Zstd::XXH64.digest(data))
+    end
+  end
+end
@@ -55,6 +55,92 @@ RSpec.describe Zstd do
       decompressed = Zstd.decompress(compressed)
       expect(decompressed).to eq('abc')
     end
+
+    it 'should reuse contexts without carrying options over' do
+      dictionary = File.read("#{__dir__}/dictionary")
+      with_options = Zstd.compress(user_json, level: 19, checksum: true, dict: dictionary)
+      expect(Zstd.decompress(with_options, dict: dictionary)).to eq(user_json)
+      plain = Zstd.compress(user_json)
+      expect(plain).to eq(Zstd.compress(user_json, level: 3))
+      expect(Zstd.frame_info(plain)[:checksum]).to eq(false)
+      expect(Zstd.frame_dict_id(plain)).to eq(0)
+      expect(Zstd.decompress(plain)).to eq(user_json)
+    end
+  end
+
+  describe 'compress with parallel' do
+    let(:large_string) do
+      Random.new(42).bytes(1 << 16) * 40
+    end
+
+    it 'should split input into independent frames' do
+      compressed = Zstd.compress(large_string, parallel: 4, frame_size: 1 << 18)
+      expect(compressed.scan("\x28\xB5\x2F\xFD".b).length).to be >= 10
+      expect(Zstd.decompress(compressed)).to eq(large_string)
+      expect(compressed).to eq(Zstd.compress(large_string, frame_size: 1 << 18))
+    end
+
+    it 'should support level and dict' do
+      compressed = Zstd.compress(user_json * 10, parallel: 2, frame_size: 1000, level: 10, dict: File.read("#{__dir__}/dictionary"))
+      expect(Zstd.decompress(compressed, dict: File.read("#{__dir__}/dictionary"))).to eq(user_json * 10)
+    end
+
+    it 'should work for empty strings' do
+      expect(Zstd.decompress(Zstd.compress('', parallel: 2))).to eq('')
+    end
+
+    it 'should append a seek table' do
+      compressed = Zstd.compress(large_string, parallel: 2, frame_size: 1 << 20, seek_table: true)
+      expect(compressed[-4..-1].unpack1('V')).to eq(0x8F92EAB1)
+      expect(compressed[-9, 4].unpack1('V')).to eq(3)
+      expect(Zstd.decompress(compressed)).to eq(large_string)
+    end
+
+    it 'should raise exception with invalid arguments' do
+      expect { Zstd.compress('abc', parallel: 0) }.to raise_error(ArgumentError)
+      expect { Zstd.compress('abc', frame_size: 0) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe 'decompress with parallel' do
+    let(:large_string) do
+      Random.new(42).bytes(1 << 16) * 40
+    end
+
+    it 'should decode frames concurrently' do
+      compressed = Zstd.compress(large_string, parallel: 4, frame_size: 1 << 18)
+      expect(Zstd.decompress(compressed, parallel: 4)).to eq(large_string)
+      expect(Zstd.decompress(compressed, parallel: 1)).to eq(large_string)
+    end
+
+    it 'should skip skippable frames and seek tables' do
+      compressed = Zstd.compress(large_string, parallel: 2, frame_size: 1 << 20, seek_table: true)
+      expect(Zstd.decompress(compressed, parallel: 2)).to eq(large_string)
+    end
+
+    it 'should support dict' do
+      compressed = Zstd.compress(user_json * 10, frame_size: 1000, dict: File.read("#{__dir__}/dictionary"))
+      expect(Zstd.decompress(compressed, parallel: 3, dict: Zstd::DDict.new(File.read("#{__dir__}/dictionary")))).to eq(user_json * 10)
+    end
+
+    it 'should fall back to serial decoding for frames without content size' do
+      stream = Zstd::StreamingCompress.new
+      stream << user_json
+      compressed = Zstd.compress('abc') + stream.finish
+      expect(Zstd.decompress(compressed, parallel: 2)).to eq("abc#{user_json}")
+    end
+
+    it 'should raise exception with broken data' do
+      compressed = Zstd.compress(large_string, frame_size: 1 << 18)
+      expect { Zstd.decompress(compressed[0..-5], parallel: 2) }.to raise_error(RuntimeError)
+      expect { Zstd.decompress('abc', parallel: 0) }.to raise_error(ArgumentError)
+    end
+
+    it 'should fall back to serial decoding for content sizes the blocks cannot hold' do
+      # one RLE block of a single byte in a frame declaring 1 TB
+      forged = [0xFD2FB528, 0xE0, 1 << 40, 0x0B, 0, 0].pack('VCQ<C3') + 'a'
+      expect { Zstd.decompress(Zstd.compress('abc') + forged, parallel: 2) }.to raise_error(RuntimeError, /decompress/i)
+    end
   end
 
   describe 'decompress' do
@@ -99,6 +185,16 @@ RSpec.describe Zstd do
       expect(Zstd.decompress(res)).to eq(large_strings * 3)
     end
 
+    it 'should decompress concatenated frames' do
+      compressed = Zstd.compress('abc') + [0x184D2A50, 4].pack('VV') + 'meta' + Zstd.compress('def') + Zstd.compress('ghi')
+      expect(Zstd.decompress(compressed)).to eq('abcdefghi')
+    end
+
+    it 'should raise exception with truncated frame' do
+      compressed = Zstd.compress(SecureRandom.hex(150))
+      expect { Zstd.decompress(compressed[0..-5]) }.to raise_error(RuntimeError)
+    end
+
     it 'should raise exception with unsupported object' do
       expect { Zstd.decompress(Object.new) }.to raise_error(TypeError)
     end
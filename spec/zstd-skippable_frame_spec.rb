@@ -30,5 +30,111 @@ RSpec.describe Zstd do
       end
     end
 
+    context 'large skippable frame' do
+      it '' do
+        metadata = SecureRandom.random_bytes(200 * 1024)
+        frame = [0x184D2A50, metadata.bytesize].pack('VV') + metadata
+        expect(Zstd.read_skippable_frame(frame)).to eq metadata
+      end
+    end
+
+    context 'magic_variant and offset' do
+      it '' do
+        compressed_data = Zstd.compress(SecureRandom.hex(150))
+        frames = compressed_data + [0x184D2A53, 4].pack('VV') + 'meta'
+        expect(Zstd.read_skippable_frame(frames, offset: compressed_data.bytesize, with_magic_variant: true)).to eq ['meta', 3]
+        expect(Zstd.read_skippable_frame(frames, offset: 1)).to eq nil
+        expect(Zstd.read_skippable_frame(frames, offset: frames.bytesize + 1)).to eq nil
+      end
+    end
+
+    context 'UTF-8 input with multibyte characters before offset' do
+      it '' do
+        payload = "caf\u00E9-meta"
+        frames = ("\u00E9\u00E9".b + [0x184D2A51, payload.bytesize].pack('VV') + payload.b).force_encoding(Encoding::UTF_8)
+        expect(Zstd.read_skippable_frame(frames, offset: 4, with_magic_variant: true)).to eq [payload.b, 1]
+      end
+    end
+
+    context 'truncated skippable frame' do
+      it '' do
+        expect { Zstd.read_skippable_frame([0x184D2A50, 10].pack('VV') + 'meta') }.to raise_error(RuntimeError)
+      end
+    end
+  end
+
+  describe 'write_skippable_frame' do
+    it 'should prepend the skippable frame to the data' do
+      compressed_data = Zstd.compress(SecureRandom.hex(150))
+      compressed_data_with_skippable_frame = Zstd.write_skippable_frame(compressed_data, "sample data", magic_variant: 2)
+      expect(compressed_data_with_skippable_frame.bytesize).to eq 8 + 11 + compressed_data.bytesize
+      expect(compressed_data_with_skippable_frame.byteslice(19..-1)).to eq compressed_data
+      expect(Zstd.read_skippable_frame(compressed_data_with_skippable_frame, with_magic_variant: true)).to eq ["sample data", 2]
+      expect(Zstd.decompress(compressed_data_with_skippable_frame)).to eq Zstd.decompress(compressed_data)
+    end
+
+    it 'should raise exception with invalid magic_variant' do
+      expect { Zstd.write_skippable_frame('', 'meta', magic_variant: 16) }.to raise_error(RuntimeError)
+    end
+  end
+
+  describe 'compress with metadata' do
+    it 'should write the metadata in front of the compressed data' do
+      data = SecureRandom.hex(150)
+      compressed = Zstd.compress(data, metadata: "sample data", magic_variant: 1)
+      expect(compressed).to eq Zstd.write_skippable_frame(Zstd.compress(data), "sample data", magic_variant: 1)
+      expect(Zstd.read_skippable_frame(compressed, with_magic_variant: true)).to eq ["sample data", 1]
+      expect(Zstd.decompress(compressed)).to eq data
+    end
+
+    it 'should work with parallel' do
+      data = SecureRandom.hex(150) * 100
+      compressed = Zstd.compress(data, metadata: "sample data", parallel: 2, frame_size: 1000)
+      expect(Zstd.read_skippable_frame(compressed)).to eq "sample data"
+      expect(Zstd.decompress(compressed)).to eq data
+      expect(Zstd.decompress(compressed, parallel: 2)).to eq data
+    end
+  end
+
+  describe 'StreamingCompress#write_skippable_frame' do
+    it 'should emit skippable frames between frames' do
+      stream = Zstd::StreamingCompress.new
+      stream.write_skippable_frame("meta1")
+      stream << "abc"
+      res = stream.finish
+      stream.write_skippable_frame("meta2", magic_variant: 1)
+      res << stream.compress("def")
+      res << stream.finish
+      expect(Zstd.each_skippable_frame(res).to_a).to eq [["meta1", 0], ["meta2", 1]]
+      expect(Zstd.decompress(res)).to eq "abcdef"
+    end
+
+    it 'should raise exception inside a frame' do
+      stream = Zstd::StreamingCompress.new
+      stream << "abc"
+      expect { stream.write_skippable_frame("meta") }.to raise_error(RuntimeError)
+    end
+  end
+
+  describe 'each_skippable_frame' do
+    it 'should yield every skippable frame' do
+      messages = Array.new(3) { |i| [0x184D2A50 + i, 5].pack('VV') + "meta#{i}" + Zstd.compress(SecureRandom.hex(150)) }
+      expect(Zstd.each_skippable_frame(messages.join).to_a).to eq [['meta0', 0], ['meta1', 1], ['meta2', 2]]
+    end
+
+    it 'should slice UTF-8 input by bytes' do
+      payload = "\u00E9\u00E9"
+      input = ([0x184D2A50, payload.bytesize].pack('VV') + payload.b + [0x184D2A51, 1].pack('VV') + 'c').force_encoding(Encoding::UTF_8)
+      expect(Zstd.each_skippable_frame(input).map { |frame, magic_variant| [frame.b, magic_variant] }).to eq [[payload.b, 0], ['c', 1]]
+    end
+
+    it 'should return the input' do
+      input = Zstd.compress('abc')
+      expect(Zstd.each_skippable_frame(input) { |_frame, _magic_variant| }).to eq input
+    end
+
+    it 'should raise exception with broken data' do
+      expect { Zstd.each_skippable_frame('abc').to_a }.to raise_error(RuntimeError)
+    end
   end
 end